@@ -0,0 +1,351 @@
+#include "cor.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+// microbenchmarks of the image kernels, e.g. 'bench --max-mp 16 photo.jpg'
+// every case reports the median time per pixel and the bytes read and written per pixel,
+// and 'bench --verify' checks instead that the bounded k means passes match the standard ones exactly
+
+struct BenchOptions {
+	// largest synthetic or rescaled image, in megapixels
+	double maxMegapixels = 100;
+
+	// each case repeats until it has run for at least this long and at least 'minRuns' times
+	double minSeconds = 0.5;
+	int minRuns = 3;
+
+	std::vector<std::string> images;
+
+	// compares lloyd and hamerly fits instead of timing, exiting with 1 on any difference
+	bool verify = false;
+};
+
+// a smooth gradient with noise on top, so both the histogram and k means see a realistic spread of colors
+Mat syntheticImage(Size size)
+{
+	Mat image(size, CV_8UC3);
+
+	for (int y = 0; y < image.rows; y++) {
+		Vec3b* pixel = image.ptr<Vec3b>(y);
+
+		for (int x = 0; x < image.cols; x++) {
+			pixel[x] = Vec3b((uchar)(255 * x / std::max(1, image.cols - 1)),
+				(uchar)(255 * y / std::max(1, image.rows - 1)),
+				(uchar)((x ^ y) & 255));
+		}
+	}
+
+	Mat noise(size, CV_8UC3);
+	RNG rng(0x636f72);
+	rng.fill(noise, RNG::UNIFORM, 0, 32);
+	add(image, noise, image);
+
+	return image;
+}
+
+// median wall time in nanoseconds of repeated runs of one case
+template <typename Kernel>
+double measure(const BenchOptions& options, Kernel kernel)
+{
+	std::vector<double> times;
+	double total = 0;
+
+	while ((int)times.size() < options.minRuns || total < options.minSeconds * 1e9) {
+		auto start = std::chrono::steady_clock::now();
+		kernel();
+		auto end = std::chrono::steady_clock::now();
+
+		double nanoseconds = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+		times.push_back(nanoseconds);
+		total += nanoseconds;
+	}
+
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+void report(const std::string& kernel, const std::string& image, Size size, const std::string& parameter, double nanoseconds, double bytes)
+{
+	double pixels = (double)size.area();
+
+	std::printf("%-16s %-24s %8.2f %-10s %12.3f %10.2f %10.2f\n",
+		kernel.c_str(), image.c_str(), pixels / 1e6, parameter.c_str(),
+		nanoseconds / pixels, bytes / pixels, bytes / nanoseconds);
+	std::fflush(stdout);
+}
+
+// fits the same image with standard and bounded passes from the same seeds, returning the number of differing cases
+int verifyImage(const std::string& name, Mat image)
+{
+	int mismatches = 0;
+
+	for (uint64 seed : { 0x636f72ull, 1ull, 0x9e3779b97f4a7c15ull }) {
+		for (int k : { 1, 2, 4, 6, 8, 10, 16, 32 }) {
+			Mat labels[2];
+			std::vector<Vec3f> centers[2];
+			std::vector<int64> counts[2];
+			double compactness[2];
+
+			// every pixel fitted untiled, so the labels of each pass are kept and compared
+			for (int run = 0; run < 2; run++) {
+				KMeansEngine engine;
+				engine.sampling = KMeansEngine::Full;
+				engine.tileRows = 0;
+				engine.randomSeed = seed;
+				engine.algorithm = run == 0 ? KMeansEngine::Lloyd : KMeansEngine::Hamerly;
+
+				compactness[run] = engine.cluster(image, k, labels[run], centers[run]);
+				counts[run] = engine.counts;
+			}
+
+			// centers come from the summed pixels of every pass, so equal centers mean every pass's sums were equal
+			bool same = compactness[0] == compactness[1] && centers[0] == centers[1] && counts[0] == counts[1]
+				&& labels[0].size() == labels[1].size() && countNonZero(labels[0] != labels[1]) == 0;
+
+			std::printf("%-16s %-24s %8.2f %-10s %s\n", "verify", name.c_str(), image.total() / 1e6,
+				("k=" + std::to_string(k)).c_str(), same ? "identical" : "MISMATCH");
+			std::fflush(stdout);
+
+			mismatches += same ? 0 : 1;
+		}
+	}
+
+	return mismatches;
+}
+
+void benchImage(const BenchOptions& options, const std::string& name, Mat image)
+{
+	ImagePipeline pipeline;
+	size_t pixels = image.total();
+
+	PipelineRequest request;
+	request.sampling = pipeline.kMeansSampling;
+	request.samples = pipeline.kMeansSamples;
+	request.histogramBits = pipeline.kMeansHistogramBits;
+	request.tileBudget = pipeline.tileBudget;
+	request.seed = pipeline.kMeansSeed;
+	request.seeded = true;
+	request.autoK = false;
+	request.algorithm = pipeline.kMeansAlgorithm;
+
+	// k means with standard and bounded passes, read once for the fit and once for the labels,
+	// writing the labels and the rendered image
+	for (KMeansEngine::Algorithm algorithm : { KMeansEngine::Lloyd, KMeansEngine::Hamerly }) {
+		request.algorithm = algorithm;
+
+		for (int k : { 1, 2, 4, 6, 8, 10 }) {
+			request.k = k;
+
+			double nanoseconds = measure(options, [&]() {
+				// forgetting the last centers so every run is a cold fit rather than a warm start
+				pipeline.kMeansSource = Mat();
+
+				std::vector<Vec3f> centers;
+				IndexedImage indexed = pipeline.kMeansImage(image, request, centers);
+				indexed.render();
+				});
+
+			report(algorithm == KMeansEngine::Hamerly ? "kMeansHamerly" : "kMeansImage", name, image.size(), "k=" + std::to_string(k), nanoseconds, (double)pixels * (3 + 3 + 1 + 3));
+		}
+	}
+
+	request.algorithm = pipeline.kMeansAlgorithm;
+
+	// automatic k, one sweep over every k up to the largest followed by a single labelling pass
+	{
+		request.k = 10;
+		request.autoK = true;
+
+		double nanoseconds = measure(options, [&]() {
+			std::vector<Vec3f> centers;
+			pipeline.kMeansImage(image, request, centers);
+			});
+
+		report("kMeansAutoK", name, image.size(), "k<=10", nanoseconds, (double)pixels * (3 + 1));
+
+		request.autoK = false;
+	}
+
+	// labelling against known centers, the path of exports and of every run after the proxy fit
+	{
+		std::vector<Vec3f> centers;
+		request.k = 6;
+		pipeline.kMeansImage(ImagePipeline::fitted(image, Size(1024, 1024)), request, centers);
+
+		double nanoseconds = measure(options, [&]() {
+			std::vector<Vec3f> fixed = centers;
+			pipeline.kMeansImage(image, request, fixed);
+			});
+
+		report("kMeansLabel", name, image.size(), "k=6", nanoseconds, (double)pixels * (3 + 1));
+	}
+
+	// pixelation reads the image and writes an image of the same size
+	for (int factor : { 1, 8, 32, 64, 128 }) {
+		double nanoseconds = measure(options, [&]() {
+			pipeline.pixelateImage(image, factor, false);
+			});
+
+		report("pixelateImage", name, image.size(), "f=" + std::to_string(factor), nanoseconds, (double)pixels * (3 + 3));
+	}
+
+	// the same pass written over a private copy, without allocating an output
+	{
+		Mat copy = image.clone();
+
+		double nanoseconds = measure(options, [&]() {
+			pipeline.pixelateImage(copy, 64, false, true, true);
+			});
+
+		report("pixelateInPlace", name, image.size(), "f=64", nanoseconds, (double)pixels * (3 + 3));
+	}
+
+	// recoloring against a palette of the most common colors, read and written once
+	{
+		ColorHistogram histogram(8);
+		histogram.build(image);
+		histogram.sortByCount();
+
+		Palette palette;
+		for (size_t i = 0; i < std::min<size_t>(10, histogram.colors.size()); i++) {
+			palette.sourceColors.push_back(histogram.colors[i]);
+			palette.targetColors.push_back(Vec3b(255, 255, 255) - histogram.colors[i]);
+		}
+
+		double nanoseconds = measure(options, [&]() {
+			pipeline.huesImage(image, palette);
+			});
+
+		report("huesImage", name, image.size(), "n=" + std::to_string(palette.sourceColors.size()), nanoseconds, (double)pixels * (3 + 3));
+	}
+
+	// color gathering only reads the image
+	{
+		double nanoseconds = measure(options, [&]() {
+			pipeline.gatherColors(image);
+			});
+
+		report("gatherColors", name, image.size(), "-", nanoseconds, (double)pixels * 3);
+	}
+
+	// display wrapping, followed by the conversion to the 32-bit format a pixmap is uploaded from
+	{
+		double nanoseconds = measure(options, [&]() {
+			QImage wrapped = ImagePipeline::imageFormat(image);
+			wrapped.convertToFormat(QImage::Format_RGB32);
+			});
+
+		report("imageFormat", name, image.size(), "-", nanoseconds, (double)pixels * (3 + 4));
+	}
+
+	// the same for a k means result kept as indices, read through its color table
+	{
+		std::vector<Vec3f> centers;
+		request.k = 6;
+		IndexedImage indexed = pipeline.kMeansImage(image, request, centers);
+
+		double nanoseconds = measure(options, [&]() {
+			QImage wrapped = ImagePipeline::imageFormat(indexed);
+			wrapped.convertToFormat(QImage::Format_RGB32);
+			});
+
+		report("indexedFormat", name, image.size(), "k=6", nanoseconds, (double)pixels * (1 + 4));
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	BenchOptions options;
+
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+
+		if (argument == "--max-mp" && i + 1 < argc) {
+			options.maxMegapixels = std::atof(argv[++i]);
+		}
+		else if (argument == "--min-time" && i + 1 < argc) {
+			options.minSeconds = std::atof(argv[++i]);
+		}
+		else if (argument == "--min-runs" && i + 1 < argc) {
+			options.minRuns = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (argument == "--verify") {
+			options.verify = true;
+		}
+		else if (argument == "--help") {
+			std::cout << "usage: bench [--verify] [--max-mp megapixels] [--min-time seconds] [--min-runs count] [image...]" << std::endl;
+			return 0;
+		}
+		else {
+			options.images.push_back(argument);
+		}
+	}
+
+	// equality of the two k means algorithms on small synthetic images and on the given images at one megapixel
+	if (options.verify) {
+		int mismatches = 0;
+
+		for (double megapixels : { 0.05, 0.25, 1.0 }) {
+			int width = (int)std::sqrt(megapixels * 1e6 * 4 / 3);
+			Size size(width, (int)(megapixels * 1e6 / width));
+
+			mismatches += verifyImage("synthetic", syntheticImage(size));
+
+			for (const std::string& path : options.images) {
+				Mat source = imread(path);
+
+				if (source.empty()) {
+					std::cerr << "bench: " << path << " could not be decoded" << std::endl;
+					continue;
+				}
+
+				Mat scaled;
+				cv::resize(source, scaled, size, 0, 0, (size_t)size.area() < source.total() ? INTER_AREA : INTER_CUBIC);
+				mismatches += verifyImage(path.substr(path.find_last_of("/\\") + 1), scaled);
+			}
+		}
+
+		std::printf("%d mismatches\n", mismatches);
+		return mismatches == 0 ? 0 : 1;
+	}
+
+	std::printf("%-16s %-24s %8s %-10s %12s %10s %10s\n", "kernel", "image", "MP", "param", "ns/pixel", "B/pixel", "GB/s");
+
+	// square-ish 4:3 sizes from 1 to 100 megapixels
+	for (double megapixels : { 1.0, 4.0, 16.0, 50.0, 100.0 }) {
+		if (megapixels > options.maxMegapixels) {
+			continue;
+		}
+
+		int width = (int)std::sqrt(megapixels * 1e6 * 4 / 3);
+		int height = (int)(megapixels * 1e6 / width);
+		Size size(width, height);
+
+		benchImage(options, "synthetic", syntheticImage(size));
+
+		// real images are rescaled to the same sizes, so their results line up with the synthetic rows
+		for (const std::string& path : options.images) {
+			Mat source = imread(path);
+
+			if (source.empty()) {
+				std::cerr << "bench: " << path << " could not be decoded" << std::endl;
+				continue;
+			}
+
+			Mat scaled;
+			cv::resize(source, scaled, size, 0, 0, (size_t)size.area() < source.total() ? INTER_AREA : INTER_CUBIC);
+
+			std::string name = path.substr(path.find_last_of("/\\") + 1);
+			benchImage(options, name, scaled);
+		}
+	}
+
+	return 0;
+}
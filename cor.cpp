@@ -2,6 +2,15 @@
 
 #include <iostream>
 #include <string>
+#include <climits>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
 
 #include <QString>
 #include <QThread>
@@ -9,9 +18,30 @@
 #include <QImage>
 #include <vector>
 #include <QMessageBox>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QDateTime>
+#include <QThreadPool>
+#include <QMutexLocker>
+#include <QFileDialog>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QPainter>
+#include <QWheelEvent>
+#include <QMouseEvent>
+#include <QResizeEvent>
 
 #include <opencv2/opencv.hpp>
 
+// vector paths for the k means engine, with a scalar fallback when neither is enabled at compile time
+#if defined(__AVX2__)
+#define COR_AVX2
+#include <immintrin.h>
+#elif defined(__SSE4_1__) || defined(__AVX__)
+#define COR_SSE41
+#include <immintrin.h>
+#endif
+
 
 using namespace cv;
 
@@ -26,52 +56,2865 @@ bool DragDropFilter::eventFilter(QObject* obj, QEvent* event)
 		return true;
 	}
 
-	// switch for determining class type of event
-	switch (event->type()) {
-	case QEvent::DragEnter:
-	{
-		// casting to QDragEnterEvent for enter event
-		auto drag_enter_event = static_cast<QDragEnterEvent*>(event);
+	// switch for determining class type of event
+	switch (event->type()) {
+	case QEvent::DragEnter:
+	{
+		// casting to QDragEnterEvent for enter event
+		auto drag_enter_event = static_cast<QDragEnterEvent*>(event);
+
+		// accepting the event and subsequent action
+		drag_enter_event->acceptProposedAction();
+
+		// using QT 'emit' mechanism to emit signal denote file has entered drag space
+		emit dragEntered(drag_enter_event->mimeData());
+		break;
+	}
+	case QEvent::DragLeave:
+	{
+		// casting to QDragLeaveEvent for leave event
+		auto drag_leave_event = static_cast<QDragLeaveEvent*>(event);
+
+		// accepting the action
+		drag_leave_event->accept();
+
+		// using QT 'emit' mechanism to emit signal to denote file has departed drag space
+		emit dragDeparted();
+		break;
+	}
+	case QEvent::Drop:
+	{
+		// casting to QDropEvent for leave event
+		auto drop_event = static_cast<QDropEvent*>(event);
+
+		// acepting the event and subsequent action
+		drop_event->acceptProposedAction();
+
+		// using QT 'emit' mechanism to emit signal to denote file has been dropped and data has been collected
+		emit dragDropped(drop_event->mimeData());
+		break;
+	}
+	default:
+
+		// returns self for program continuity
+		return QObject::eventFilter(obj, event);
+	}
+
+	// QT 'eventFilter' objects must return boolean objects
+	return true;
+}
+
+
+thread_local int64 Trace::allocations = 0;
+thread_local int64 Trace::allocatedBytes = 0;
+
+static QMutex& traceMutex()
+{
+	static QMutex mutex;
+	return mutex;
+}
+static std::vector<Trace::Event>& traceEvents()
+{
+	static std::vector<Trace::Event> events;
+	return events;
+}
+bool Trace::enabled()
+{
+	static const bool on = start();
+	return on;
+}
+bool Trace::start()
+{
+	if (qEnvironmentVariable("COR_TRACE").isEmpty()) {
+		return false;
+	}
+
+	// counting image allocations only once tracing is on, and writing the events when the program exits
+	static TraceAllocator allocator;
+	Mat::setDefaultAllocator(&allocator);
+
+	// the event store and clock are created before registering the writer, so they outlive it
+	traceMutex();
+	traceEvents();
+	now();
+	std::atexit(Trace::write);
+
+	return true;
+}
+double Trace::now()
+{
+	// microseconds since the first traced event
+	static const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+}
+int Trace::thread()
+{
+	// small sequential ids, which read better in the trace viewer than native handles
+	static std::atomic<int> next(1);
+	thread_local int id = next++;
+	return id;
+}
+void Trace::record(Event event)
+{
+	QMutexLocker locker(&traceMutex());
+	traceEvents().push_back(std::move(event));
+}
+void Trace::write()
+{
+	QMutexLocker locker(&traceMutex());
+
+	std::ofstream file(qEnvironmentVariable("COR_TRACE").toStdString());
+
+	if (!file) {
+		std::cerr << "cor: the trace could not be written" << std::endl;
+		return;
+	}
+
+	// chrome's json trace format, one complete event per scope
+	file << "{\"traceEvents\":[";
+
+	const std::vector<Event>& events = traceEvents();
+	for (size_t i = 0; i < events.size(); i++) {
+		const Event& event = events[i];
+
+		file << (i == 0 ? "\n" : ",\n")
+			<< "{\"name\":\"" << event.name << "\",\"cat\":\"cor\",\"ph\":\"X\",\"pid\":1"
+			<< ",\"tid\":" << event.thread
+			<< ",\"ts\":" << std::fixed << std::setprecision(3) << event.start
+			<< ",\"dur\":" << event.duration
+			<< ",\"args\":{" << event.arguments << "}}";
+	}
+
+	file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+
+TraceScope::TraceScope(const char* name, Size size, std::initializer_list<std::pair<const char*, double>> parameters)
+{
+	active = Trace::enabled();
+
+	if (!active) {
+		return;
+	}
+
+	this->name = name;
+	this->size = size;
+
+	for (const auto& parameter : parameters) {
+		arguments += "\"" + std::string(parameter.first) + "\":" + std::to_string(parameter.second) + ",";
+	}
+
+	allocations = Trace::allocations;
+	allocatedBytes = Trace::allocatedBytes;
+	start = Trace::now();
+}
+TraceScope::~TraceScope()
+{
+	if (!active) {
+		return;
+	}
+
+	Trace::Event event;
+	event.name = name;
+	event.start = start;
+	event.duration = Trace::now() - start;
+	event.thread = Trace::thread();
+
+	// allocations made on this thread inside the scope, work handed to other threads not being counted
+	event.arguments = arguments
+		+ "\"width\":" + std::to_string(size.width)
+		+ ",\"height\":" + std::to_string(size.height)
+		+ ",\"allocations\":" + std::to_string(Trace::allocations - allocations)
+		+ ",\"allocated bytes\":" + std::to_string(Trace::allocatedBytes - allocatedBytes);
+
+	Trace::record(std::move(event));
+}
+void TraceScope::annotate(Size size)
+{
+	this->size = size;
+}
+
+
+UMatData* TraceAllocator::allocate(int dims, const int* sizes, int type, void* data, size_t* step, AccessFlag flags, UMatUsageFlags usageFlags) const
+{
+	UMatData* result = Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+
+	// buffers passed in by the caller are wrapped rather than allocated
+	if (result && !data) {
+		Trace::allocations++;
+		Trace::allocatedBytes += (int64)result->size;
+	}
+
+	return result;
+}
+bool TraceAllocator::allocate(UMatData* data, AccessFlag flags, UMatUsageFlags usageFlags) const
+{
+	return Mat::getStdAllocator()->allocate(data, flags, usageFlags);
+}
+void TraceAllocator::deallocate(UMatData* data) const
+{
+	Mat::getStdAllocator()->deallocate(data);
+}
+
+
+ImageCache::ImageCache(size_t budget)
+{
+	// memory budget in bytes for every decoded image and variant held
+	this->budget = budget;
+	usage = 0;
+
+	// prefetches decode one file at a time
+	prefetchPool.setMaxThreadCount(1);
+}
+int ImageCache::reduction(String imagePath, Size bounds)
+{
+	// only jpeg decoders scale while decoding, other formats would be decoded in full and resized twice
+	QImageReader reader(QString::fromStdString(imagePath));
+	QSize size = reader.size();
+
+	if (reader.format() != "jpeg" || !size.isValid() || bounds.width <= 0 || bounds.height <= 0) {
+		return 1;
+	}
+
+	// the scale the proxy is fitted at, taken over both orientations since the decoder applies exif rotation
+	double factor = std::max(std::min((double)bounds.width / size.width(), (double)bounds.height / size.height()),
+		std::min((double)bounds.width / size.height(), (double)bounds.height / size.width()));
+
+	// the coarsest reduction whose output still covers the proxy, so it is only ever scaled down
+	for (int reduction : { 8, 4, 2 }) {
+		if (1.0 / reduction >= factor) {
+			return reduction;
+		}
+	}
+
+	return 1;
+}
+Mat ImageCache::decode(String imagePath, int reduction)
+{
+	// reduced decodes come out of the jpeg decoder's dct scaling at a fraction of the cost of a full decode
+	switch (reduction) {
+	case 2:
+		return imread(imagePath, IMREAD_REDUCED_COLOR_2);
+	case 4:
+		return imread(imagePath, IMREAD_REDUCED_COLOR_4);
+	case 8:
+		return imread(imagePath, IMREAD_REDUCED_COLOR_8);
+	default:
+		return imread(imagePath);
+	}
+}
+std::list<ImageCache::Entry>::iterator ImageCache::lookup(String imagePath, int reduction)
+{
+	// file metadata used to tell whether a cached decode is still current
+	QString path = QString::fromStdString(imagePath);
+	QFileInfo info(path);
+
+	if (!info.exists()) {
+		return entries.end();
+	}
+
+	qint64 modified = info.lastModified().toMSecsSinceEpoch();
+	qint64 size = info.size();
+
+	// a file already being decoded by another thread, such as a prefetch, is waited for rather than decoded twice
+	while (pending.contains(path)) {
+		decoded.wait(&mutex);
+	}
+
+	for (auto entry = entries.begin(); entry != entries.end(); entry++) {
+		if (entry->path != path) {
+			continue;
+		}
+
+		// stale entries are dropped so the file is decoded again, as are reduced decodes coarser than wanted
+		if (entry->modified != modified || entry->size != size || entry->reduction > reduction) {
+			usage -= entry->bytes;
+			entries.erase(entry);
+			break;
+		}
+
+		// moving the hit to the front of the list as most recently used
+		entries.splice(entries.begin(), entries, entry);
+		return entries.begin();
+	}
+
+	// decoding on a miss without holding the lock, so hits on other files are not held up behind it,
+	// kept in OpenCV's native 'bgr' order so no conversion copy is made
+	pending.insert(path);
+	mutex.unlock();
+
+	Mat input;
+	{
+		TraceScope trace("imread", Size(), { { "reduction", reduction } });
+		input = decode(imagePath, reduction);
+		trace.annotate(input.size());
+	}
+
+	mutex.lock();
+	pending.remove(path);
+	decoded.wakeAll();
+
+	if (input.empty()) {
+		return entries.end();
+	}
+
+	Entry entry;
+	entry.path = path;
+	entry.modified = modified;
+	entry.size = size;
+
+	entry.image = input;
+	entry.reduction = reduction;
+	entry.bytes = entry.image.total() * entry.image.elemSize();
+
+	entries.push_front(entry);
+	usage += entry.bytes;
+
+	evict();
+
+	return entries.begin();
+}
+Mat ImageCache::source(String imagePath)
+{
+	QMutexLocker locker(&mutex);
+
+	// full resolution decode, shared with the cache and so never to be written in place
+	auto entry = lookup(imagePath, 1);
+
+	if (entry == entries.end()) {
+		return Mat();
+	}
+
+	return entry->image;
+}
+Mat ImageCache::scaled(String imagePath, int width, int height)
+{
+	// reading the header before taking the lock, to pick a reduced decode that still covers the bounds
+	int wanted = reduction(imagePath, Size(width, height));
+
+	QMutexLocker locker(&mutex);
+
+	// a full or finer decode already cached is used as is
+	auto entry = lookup(imagePath, wanted);
+
+	if (entry == entries.end()) {
+		return Mat();
+	}
+
+	// sources that already fit inside the bounds are returned as is
+	Mat image = entry->image;
+	double factor = std::min((double)width / image.cols, (double)height / image.rows);
+
+	if (factor >= 1.0) {
+		return image;
+	}
+
+	for (auto& variant : entry->variants) {
+		if (variant.first == Size(width, height)) {
+			return variant.second;
+		}
+	}
+
+	// downscaling with OpenCV flag INTER_AREA and keeping the variant alongside its source
+	Mat output;
+	Size target(std::max(1, (int)(image.cols * factor)), std::max(1, (int)(image.rows * factor)));
+	cv::resize(image, output, target, 0, 0, INTER_AREA);
+
+	size_t bytes = output.total() * output.elemSize();
+	entry->variants.push_back({ Size(width, height), output });
+	entry->bytes += bytes;
+	usage += bytes;
+
+	evict();
+
+	return output;
+}
+void ImageCache::prefetch(String imagePath, Size bounds)
+{
+	QString path = QString::fromStdString(imagePath);
+
+	{
+		QMutexLocker locker(&mutex);
+
+		// a file already queued, being decoded or cached at these bounds needs no further task,
+		// as every preview asks for the next file again
+		if (prefetching.contains(path) || pending.contains(path)) {
+			return;
+		}
+
+		for (const Entry& entry : entries) {
+			if (entry.path != path) {
+				continue;
+			}
+
+			if (entry.image.cols <= bounds.width && entry.image.rows <= bounds.height) {
+				return;
+			}
+
+			for (const auto& variant : entry.variants) {
+				if (variant.first == bounds) {
+					return;
+				}
+			}
+		}
+
+		prefetching.insert(path);
+	}
+
+	// decoding and downscaling on the cache's own single thread, so prefetches never hold the global pool
+	// threads previews and exports run on, and a later load of the same file is a cache hit
+	prefetchPool.start([this, imagePath, bounds, path]() {
+		{
+			TraceScope trace("prefetch", bounds);
+			scaled(imagePath, bounds.width, bounds.height);
+		}
+
+		QMutexLocker locker(&mutex);
+		prefetching.remove(path);
+		});
+}
+void ImageCache::setBudget(size_t bytes)
+{
+	QMutexLocker locker(&mutex);
+
+	budget = bytes;
+	evict();
+}
+void ImageCache::clear()
+{
+	QMutexLocker locker(&mutex);
+
+	entries.clear();
+	usage = 0;
+}
+void ImageCache::evict()
+{
+	// dropping least recently used entries until under budget, always keeping the newest one
+	while (usage > budget && entries.size() > 1) {
+		usage -= entries.back().bytes;
+		entries.pop_back();
+	}
+}
+
+
+ColorHistogram::ColorHistogram(int bits)
+{
+	this->bits = std::max(1, std::min(bits, 8));
+}
+uint32_t ColorHistogram::key(const uchar* pixel) const
+{
+	int shift = 8 - bits;
+	return ((uint32_t)(pixel[0] >> shift) << (2 * bits)) | ((uint32_t)(pixel[1] >> shift) << bits) | (uint32_t)(pixel[2] >> shift);
+}
+size_t ColorHistogram::keySpace() const
+{
+	return (size_t)1 << (3 * bits);
+}
+Vec3b ColorHistogram::color(uint32_t key) const
+{
+	// reduced bins are represented by their middle value
+	int shift = 8 - bits;
+	uint32_t mask = (1u << bits) - 1;
+	int middle = (1 << shift) >> 1;
+
+	return Vec3b((uchar)((((key >> (2 * bits)) & mask) << shift) | middle),
+		(uchar)((((key >> bits) & mask) << shift) | middle),
+		(uchar)(((key & mask) << shift) | middle));
+}
+void ColorHistogram::build(Mat image)
+{
+	CV_Assert(image.type() == CV_8UC3);
+
+	// rows are split into stripes, each counting into its own table
+	int stripes = std::max(1, std::min(image.rows, getNumThreads() * 4));
+	std::vector<Table> partials(stripes);
+
+	parallel_for_(Range(0, stripes), [&](const Range& range) {
+		for (int stripe = range.start; stripe < range.end; stripe++) {
+			int begin = (int)((int64)image.rows * stripe / stripes);
+			int end = (int)((int64)image.rows * (stripe + 1) / stripes);
+
+			Table& table = partials[stripe];
+
+			for (int y = begin; y < end; y++) {
+				const uchar* p = image.ptr<uchar>(y);
+
+				// runs of one color are counted once, common in artwork and pixelated images
+				uint32_t run = key(p);
+				int64 length = 0;
+
+				for (int x = 0; x < image.cols; x++, p += 3) {
+					uint32_t current = key(p);
+
+					if (current != run) {
+						table.add(run, length);
+						run = current;
+						length = 0;
+					}
+
+					length++;
+				}
+
+				table.add(run, length);
+			}
+		}
+		});
+
+	// merging the stripes into one table
+	Table merged;
+	for (Table& table : partials) {
+		for (size_t i = 0; i < table.keys.size(); i++) {
+			if (table.counts[i] > 0) {
+				merged.add(table.keys[i], table.counts[i]);
+			}
+		}
+	}
+
+	// the table's slot order depends on insertion order and so on the stripe count, which follows the
+	// thread count, so entries are emitted in key order to keep seeding and chunking the same on every machine
+	std::vector<size_t> slots;
+	slots.reserve(merged.used);
+
+	for (size_t i = 0; i < merged.keys.size(); i++) {
+		if (merged.counts[i] > 0) {
+			slots.push_back(i);
+		}
+	}
+
+	std::sort(slots.begin(), slots.end(), [&merged](size_t a, size_t b) {
+		return merged.keys[a] < merged.keys[b];
+		});
+
+	colors.clear();
+	counts.clear();
+	colors.reserve(slots.size());
+	counts.reserve(slots.size());
+
+	for (size_t slot : slots) {
+		colors.push_back(color(merged.keys[slot]));
+		counts.push_back(merged.counts[slot]);
+	}
+}
+void ColorHistogram::sortByCount()
+{
+	// ordering entries by descending pixel count, ties by color so the order is stable between runs
+	std::vector<size_t> order(colors.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		order[i] = i;
+	}
+
+	std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+		if (counts[a] != counts[b]) {
+			return counts[a] > counts[b];
+		}
+		return key(colors[a].val) < key(colors[b].val);
+		});
+
+	std::vector<Vec3b> sortedColors(order.size());
+	std::vector<int64> sortedCounts(order.size());
+
+	for (size_t i = 0; i < order.size(); i++) {
+		sortedColors[i] = colors[order[i]];
+		sortedCounts[i] = counts[order[i]];
+	}
+
+	colors.swap(sortedColors);
+	counts.swap(sortedCounts);
+}
+ColorHistogram::Table::Table()
+{
+	keys.assign(1024, 0);
+	counts.assign(1024, 0);
+	used = 0;
+}
+void ColorHistogram::Table::add(uint32_t key, int64 count)
+{
+	// keeping the load under a half so probe runs stay short
+	if ((used + 1) * 2 > keys.size()) {
+		grow();
+	}
+
+	// multiplicative hash, scaled from its full 32 bits down to the table size
+	size_t mask = keys.size() - 1;
+	size_t slot = (size_t)(((uint64_t)(uint32_t)(key * 2654435761u) * keys.size()) >> 32);
+
+	// linear probing, an empty slot being one with no count
+	while (counts[slot] > 0 && keys[slot] != key) {
+		slot = (slot + 1) & mask;
+	}
+
+	if (counts[slot] == 0) {
+		keys[slot] = key;
+		used++;
+	}
+
+	counts[slot] += count;
+}
+void ColorHistogram::Table::grow()
+{
+	std::vector<uint32_t> oldKeys;
+	std::vector<int64> oldCounts;
+	oldKeys.swap(keys);
+	oldCounts.swap(counts);
+
+	keys.assign(oldKeys.size() * 2, 0);
+	counts.assign(oldCounts.size() * 2, 0);
+	used = 0;
+
+	for (size_t i = 0; i < oldKeys.size(); i++) {
+		if (oldCounts[i] > 0) {
+			add(oldKeys[i], oldCounts[i]);
+		}
+	}
+}
+
+
+// out of class definition, needed before c++17 since std::min takes the bound by reference
+constexpr int KMeansEngine::maxCenters;
+
+KMeansEngine::KMeansEngine(int iterations, double epsilon, int attempts)
+{
+	this->iterations = std::max(iterations, 1);
+	this->epsilon = std::max(epsilon, 0.0);
+	this->attempts = std::max(attempts, 1);
+
+	// every pixel is clustered until a sampling mode is chosen
+	sampling = Full;
+	sampleSize = 65536;
+	histogramBits = 6;
+
+	// whole image passes until a tile height is set
+	tileRows = 0;
+
+	// a fixed seed, so the same image and settings always give the same centers
+	randomSeed = 0x636f72;
+
+	// standard passes until the bounded ones are chosen
+	algorithm = Lloyd;
+}
+RNG KMeansEngine::attemptRNG(int attempt) const
+{
+	// every attempt draws from its own generator, so results do not depend on which thread ran it
+	return RNG(randomSeed ^ ((uint64)(attempt + 1) * 0x9e3779b97f4a7c15ull));
+}
+bool KMeansEngine::parallelAttempts(int64 points, int runs) const
+{
+	// attempts only run side by side when each is too small to use every thread by itself, since the
+	// passes inside an attempt then run serially on the thread it was given rather than oversubscribing
+	return runs > 1 && points <= (int64)1 << 20;
+}
+double KMeansEngine::cluster(Mat image, int k, Mat& labels, std::vector<Vec3f>& centers)
+{
+	CV_Assert(image.type() == CV_8UC3);
+
+	k = std::max(1, std::min(k, maxCenters));
+
+	// histogram mode clusters the distinct colors instead of the pixels
+	if (sampling == Histogram) {
+		return clusterHistogram(image, k, labels, centers);
+	}
+
+	// centers are only fitted on a sample when the image holds more pixels than the sample
+	bool sampled = sampling != Full && sampleSize > 0 && (int64)image.total() > sampleSize;
+	double bestCompactness = DBL_MAX;
+
+	std::vector<int64> sums;
+
+	// a warm start already sits near a solution, so a single attempt is enough
+	int runs = warmCenters.empty() ? attempts : 1;
+
+	std::vector<std::vector<Vec3f>> attemptCenters(runs);
+	std::vector<std::vector<int64>> attemptSums(runs);
+	std::vector<Mat> attemptLabels(runs);
+	std::vector<double> attemptCompactness(runs);
+
+	auto runAttempt = [&](int attempt) {
+		RNG rng = attemptRNG(attempt);
+
+		if (!sampled) {
+			attemptCenters[attempt] = seed(image, k, rng);
+			attemptCompactness[attempt] = fit(image, attemptCenters[attempt], attemptLabels[attempt], attemptSums[attempt]);
+		}
+		else if (sampling == MiniBatch) {
+			attemptCenters[attempt] = seed(sample(image, batchSize(), false, rng), k, rng);
+			attemptCompactness[attempt] = fitMiniBatch(image, attemptCenters[attempt], rng);
+		}
+		else {
+			Mat points = sample(image, sampleSize, sampling == Stratified, rng);
+			attemptCenters[attempt] = seed(points, k, rng);
+			attemptCompactness[attempt] = fit(points, attemptCenters[attempt], attemptLabels[attempt], attemptSums[attempt]);
+		}
+	};
+
+	int64 fitted = sampled ? (sampling == MiniBatch ? batchSize() : sampleSize) : (int64)image.total();
+
+	if (parallelAttempts(fitted, runs)) {
+		parallel_for_(Range(0, runs), [&](const Range& range) {
+			for (int attempt = range.start; attempt < range.end; attempt++) {
+				runAttempt(attempt);
+			}
+			}, runs);
+	}
+	else {
+		for (int attempt = 0; attempt < runs; attempt++) {
+			runAttempt(attempt);
+		}
+	}
+
+	// keeping the tightest attempt, the earliest one on ties
+	for (int attempt = 0; attempt < runs; attempt++) {
+		if (attemptCompactness[attempt] < bestCompactness) {
+			bestCompactness = attemptCompactness[attempt];
+			centers = attemptCenters[attempt];
+			labels = attemptLabels[attempt];
+			sums = attemptSums[attempt];
+		}
+	}
+
+	// a single labelling pass over the full image with the centers fitted on the sample or tile by tile
+	if (sampled || tileRows > 0) {
+		bestCompactness = assign(image, centers, labels, sums);
+	}
+
+	// pixels per cluster, kept so a later pass can warm start from these centers
+	counts.assign(k, 0);
+	for (int j = 0; j < k; j++) {
+		counts[j] = sums[j * 4 + 3];
+	}
+
+	return bestCompactness;
+}
+double KMeansEngine::sweep(Mat image, int maxK, Mat& labels, std::vector<Vec3f>& centers, std::vector<double>& inertia)
+{
+	CV_Assert(image.type() == CV_8UC3);
+
+	maxK = std::max(1, std::min(maxK, maxCenters));
+
+	// one sample shared by every k, histogram mode sampling pixels like stratified mode
+	RNG rng = attemptRNG(0);
+	bool sampled = sampling != Full && sampleSize > 0 && (int64)image.total() > sampleSize;
+	Mat points = sampled ? sample(image, sampleSize, sampling != Random, rng) : image;
+
+	// each k starts from the centers of the one before, with a single k means++ pick added,
+	// so every step after the first only needs a few short iterations
+	std::vector<Vec3f> savedCenters = warmCenters;
+	std::vector<int64> savedCounts = warmCounts;
+
+	std::vector<std::vector<Vec3f>> fits;
+	inertia.clear();
+	warmCenters.clear();
+	warmCounts.clear();
+
+	for (int k = 1; k <= maxK; k++) {
+		Mat pointLabels;
+		std::vector<int64> sums;
+
+		std::vector<Vec3f> fitted = seed(points, k, rng);
+		double compactness = fit(points, fitted, pointLabels, sums);
+
+		// inertia per point, so the curve does not depend on the sample size
+		inertia.push_back(compactness / std::max<double>(1, (double)points.total()));
+		fits.push_back(fitted);
+
+		warmCenters = fitted;
+		warmCounts.assign(k, 0);
+		for (int j = 0; j < k; j++) {
+			warmCounts[j] = sums[j * 4 + 3];
+		}
+	}
+
+	warmCenters = savedCenters;
+	warmCounts = savedCounts;
+
+	// labelling the full image with the centers of the chosen k
+	centers = fits[elbow(inertia) - 1];
+
+	std::vector<int64> sums;
+	double compactness = assign(image, centers, labels, sums);
+
+	counts.assign(centers.size(), 0);
+	for (size_t j = 0; j < centers.size(); j++) {
+		counts[j] = sums[j * 4 + 3];
+	}
+
+	return compactness;
+}
+int KMeansEngine::elbow(const std::vector<double>& inertia)
+{
+	int count = (int)inertia.size();
+
+	if (count <= 1) {
+		return 1;
+	}
+
+	// with only two points there is no chord to fall below, so the second cluster is kept when it at least
+	// halves the inertia of a single one
+	if (count == 2) {
+		return inertia[0] > 0 && inertia[1] <= inertia[0] * 0.5 ? 2 : 1;
+	}
+
+	// the k furthest below the straight line from the first to the last point of the normalized curve
+	double range = inertia.front() - inertia.back();
+
+	if (range <= 0) {
+		return 1;
+	}
+
+	int chosen = 1;
+	double furthest = 0;
+
+	for (int i = 1; i < count - 1; i++) {
+		double x = (double)i / (count - 1);
+		double y = (inertia[i] - inertia.back()) / range;
+		double below = (1.0 - x) - y;
+
+		if (below > furthest) {
+			furthest = below;
+			chosen = i + 1;
+		}
+	}
+
+	return chosen;
+}
+double KMeansEngine::fit(Mat points, std::vector<Vec3f>& centers, Mat& labels, std::vector<int64>& sums)
+{
+	int k = (int)centers.size();
+
+	// OpenCV compares the squared center shift against the squared epsilon
+	double epsilonSquared = epsilon * epsilon;
+
+	// hamerly's bounds carried between the passes of this fit, unused by the standard passes
+	Bounds bounds;
+
+	// tiled fitting only keeps center statistics, the labels being produced once at the end
+	double compactness = step(points, centers, labels, sums, bounds);
+
+	// lloyd iterations, moving each center to the mean of its pixels and reassigning
+	for (int iteration = 1; iteration < iterations; iteration++) {
+		double shift = 0;
+
+		for (int j = 0; j < k; j++) {
+			int64 count = sums[j * 4 + 3];
+
+			// empty clusters keep their previous center
+			if (count == 0) {
+				continue;
+			}
+
+			Vec3f center((float)((double)sums[j * 4] / count),
+				(float)((double)sums[j * 4 + 1] / count),
+				(float)((double)sums[j * 4 + 2] / count));
+
+			Vec3f delta = center - centers[j];
+			shift = std::max(shift, (double)delta.dot(delta));
+			centers[j] = center;
+		}
+
+		compactness = step(points, centers, labels, sums, bounds);
+
+		if (shift <= epsilonSquared) {
+			break;
+		}
+	}
+
+	return compactness;
+}
+double KMeansEngine::step(Mat points, const std::vector<Vec3f>& centers, Mat& labels, std::vector<int64>& sums, Bounds& bounds)
+{
+	if (tileRows > 0) {
+		return accumulate(points, centers, sums);
+	}
+
+	// the bounds need a value per pixel kept across passes, so they are only used untiled
+	if (algorithm == Hamerly) {
+		return assignBounded(points, centers, labels, sums, bounds);
+	}
+
+	return assign(points, centers, labels, sums);
+}
+double KMeansEngine::accumulate(Mat image, const std::vector<Vec3f>& centers, std::vector<int64>& sums)
+{
+	int k = (int)centers.size();
+
+	sums.assign(k * 4, 0);
+	double compactness = 0;
+
+	// one strip of rows at a time, reusing a strip sized label buffer
+	Mat tileLabels;
+	std::vector<int64> tileSums;
+
+	for (int top = 0; top < image.rows; top += tileRows) {
+		Mat tile = image.rowRange(top, std::min(image.rows, top + tileRows));
+		compactness += assign(tile, centers, tileLabels, tileSums);
+
+		for (int i = 0; i < k * 4; i++) {
+			sums[i] += tileSums[i];
+		}
+	}
+
+	return compactness;
+}
+double KMeansEngine::label(Mat image, const std::vector<Vec3f>& centers, Mat& labels)
+{
+	CV_Assert(image.type() == CV_8UC3);
+
+	// a single assignment pass against centers fitted elsewhere
+	std::vector<int64> sums;
+	double compactness = assign(image, centers, labels, sums);
+
+	counts.assign(centers.size(), 0);
+	for (size_t j = 0; j < centers.size(); j++) {
+		counts[j] = sums[j * 4 + 3];
+	}
+
+	return compactness;
+}
+int KMeansEngine::batchSize() const
+{
+	// each mini batch step draws a fresh random batch of a quarter of the sample size
+	return std::max(1024, sampleSize / 4);
+}
+double KMeansEngine::fitMiniBatch(Mat image, std::vector<Vec3f>& centers, RNG& rng)
+{
+	int k = (int)centers.size();
+	int batchSize = this->batchSize();
+
+	double epsilonSquared = epsilon * epsilon;
+
+	// pixels seen so far by every center, giving each a decaying learning rate
+	std::vector<int64> seen(k, 0);
+	std::vector<int64> sums;
+	Mat batchLabels;
+
+	double compactness = 0;
+
+	for (int step = 0; step < iterations * 4; step++) {
+		Mat batch = sample(image, batchSize, false, rng);
+		compactness = assign(batch, centers, batchLabels, sums);
+
+		double shift = 0;
+
+		for (int j = 0; j < k; j++) {
+			int64 count = sums[j * 4 + 3];
+
+			if (count == 0) {
+				continue;
+			}
+
+			// moving the center toward the batch mean by the share of pixels this batch contributed
+			seen[j] += count;
+			double rate = (double)count / seen[j];
+
+			Vec3f mean((float)((double)sums[j * 4] / count),
+				(float)((double)sums[j * 4 + 1] / count),
+				(float)((double)sums[j * 4 + 2] / count));
+
+			Vec3f delta = (mean - centers[j]) * (float)rate;
+			shift = std::max(shift, (double)delta.dot(delta));
+			centers[j] += delta;
+		}
+
+		if (step >= iterations && shift <= epsilonSquared) {
+			break;
+		}
+	}
+
+	// compactness of the last batch, scaled up so attempts compare on the same footing
+	return compactness * ((double)image.total() / batchSize);
+}
+double KMeansEngine::clusterHistogram(Mat image, int k, Mat& labels, std::vector<Vec3f>& centers)
+{
+	ColorHistogram histogram(histogramBits);
+	histogram.build(image);
+
+	double bestCompactness = DBL_MAX;
+	std::vector<uchar> entryLabels;
+
+	int runs = warmCenters.empty() ? attempts : 1;
+
+	std::vector<std::vector<Vec3f>> attemptCenters(runs);
+	std::vector<std::vector<uchar>> attemptLabels(runs);
+	std::vector<double> attemptCompactness(runs);
+
+	// every iteration now costs the number of distinct colors rather than the resolution
+	auto runAttempt = [&](int attempt) {
+		RNG rng = attemptRNG(attempt);
+		attemptCenters[attempt] = seedHistogram(histogram, k, rng);
+		attemptCompactness[attempt] = fitHistogram(histogram, attemptCenters[attempt], attemptLabels[attempt]);
+	};
+
+	if (parallelAttempts((int64)histogram.colors.size(), runs)) {
+		parallel_for_(Range(0, runs), [&](const Range& range) {
+			for (int attempt = range.start; attempt < range.end; attempt++) {
+				runAttempt(attempt);
+			}
+			}, runs);
+	}
+	else {
+		for (int attempt = 0; attempt < runs; attempt++) {
+			runAttempt(attempt);
+		}
+	}
+
+	for (int attempt = 0; attempt < runs; attempt++) {
+		if (attemptCompactness[attempt] < bestCompactness) {
+			bestCompactness = attemptCompactness[attempt];
+			centers = attemptCenters[attempt];
+			entryLabels = attemptLabels[attempt];
+		}
+	}
+
+	// dense lookup table from packed key to cluster, the pixels being mapped back through it
+	std::vector<uchar> table(histogram.keySpace(), 0);
+	counts.assign(k, 0);
+
+	for (size_t i = 0; i < histogram.colors.size(); i++) {
+		table[histogram.key(histogram.colors[i].val)] = entryLabels[i];
+		counts[entryLabels[i]] += histogram.counts[i];
+	}
+
+	labels.create(image.rows, image.cols, CV_8U);
+
+	parallel_for_(Range(0, image.rows), [&](const Range& range) {
+		for (int y = range.start; y < range.end; y++) {
+			const uchar* p = image.ptr<uchar>(y);
+			uchar* label = labels.ptr<uchar>(y);
+
+			for (int x = 0; x < image.cols; x++, p += 3) {
+				label[x] = table[histogram.key(p)];
+			}
+		}
+		});
+
+	return bestCompactness;
+}
+std::vector<Vec3f> KMeansEngine::seedHistogram(const ColorHistogram& histogram, int k, RNG& rng)
+{
+	// k means++ seeding over the histogram entries, each weighted by its pixel count
+	std::vector<Vec3f> points(histogram.colors.size());
+	std::vector<double> weights(histogram.colors.size());
+
+	for (size_t i = 0; i < points.size(); i++) {
+		points[i] = Vec3f(histogram.colors[i][0], histogram.colors[i][1], histogram.colors[i][2]);
+		weights[i] = (double)histogram.counts[i];
+	}
+
+	return start(points, weights, k, rng);
+}
+double KMeansEngine::fitHistogram(const ColorHistogram& histogram, std::vector<Vec3f>& centers, std::vector<uchar>& labels)
+{
+	int k = (int)centers.size();
+	double epsilonSquared = epsilon * epsilon;
+
+	std::vector<double> sums;
+	double compactness = assignHistogram(histogram, centers, labels, sums);
+
+	// weighted lloyd iterations, each entry counting as many times as it has pixels
+	for (int iteration = 1; iteration < iterations; iteration++) {
+		double shift = 0;
+
+		for (int j = 0; j < k; j++) {
+			double count = sums[j * 4 + 3];
+
+			if (count == 0) {
+				continue;
+			}
+
+			Vec3f center((float)(sums[j * 4] / count), (float)(sums[j * 4 + 1] / count), (float)(sums[j * 4 + 2] / count));
+
+			Vec3f delta = center - centers[j];
+			shift = std::max(shift, (double)delta.dot(delta));
+			centers[j] = center;
+		}
+
+		compactness = assignHistogram(histogram, centers, labels, sums);
+
+		if (shift <= epsilonSquared) {
+			break;
+		}
+	}
+
+	return compactness;
+}
+double KMeansEngine::assignHistogram(const ColorHistogram& histogram, const std::vector<Vec3f>& centers, std::vector<uchar>& labels, std::vector<double>& sums)
+{
+	int k = (int)centers.size();
+	int entries = (int)histogram.colors.size();
+
+	labels.resize(entries);
+
+	// entries are split into chunks, each with its own partial sums merged in order, the chunk count
+	// not depending on the thread count so the floating point sums come out the same on any machine
+	int chunks = std::max(1, std::min(entries / 1024 + 1, 64));
+	std::vector<std::vector<double>> partialSums(chunks, std::vector<double>(k * 4, 0));
+	std::vector<double> partialDistortion(chunks, 0);
+
+	parallel_for_(Range(0, chunks), [&](const Range& range) {
+		for (int chunk = range.start; chunk < range.end; chunk++) {
+			int begin = (int)((int64)entries * chunk / chunks);
+			int end = (int)((int64)entries * (chunk + 1) / chunks);
+
+			for (int i = begin; i < end; i++) {
+				Vec3f color(histogram.colors[i][0], histogram.colors[i][1], histogram.colors[i][2]);
+
+				float best = FLT_MAX;
+				int label = 0;
+
+				for (int j = 0; j < k; j++) {
+					Vec3f delta = color - centers[j];
+					float distance = delta.dot(delta);
+
+					if (distance < best) {
+						best = distance;
+						label = j;
+					}
+				}
+
+				double weight = (double)histogram.counts[i];
+
+				labels[i] = (uchar)label;
+				partialDistortion[chunk] += best * weight;
+
+				partialSums[chunk][label * 4] += color[0] * weight;
+				partialSums[chunk][label * 4 + 1] += color[1] * weight;
+				partialSums[chunk][label * 4 + 2] += color[2] * weight;
+				partialSums[chunk][label * 4 + 3] += weight;
+			}
+		}
+		});
+
+	sums.assign(k * 4, 0);
+	double distortion = 0;
+
+	for (int chunk = 0; chunk < chunks; chunk++) {
+		for (int i = 0; i < k * 4; i++) {
+			sums[i] += partialSums[chunk][i];
+		}
+		distortion += partialDistortion[chunk];
+	}
+
+	return distortion;
+}
+Mat KMeansEngine::sample(Mat image, int count, bool stratified, RNG& rng)
+{
+	// packed into rows of up to 1024 so the sample is striped across threads like an image, with enough
+	// pixels drawn to fill the last row exactly, so every drawn pixel is fitted and none are dropped
+	int width = std::max(1, std::min(count, 1024));
+	int target = ((std::max(1, count) + width - 1) / width) * width;
+
+	std::vector<Vec3b> pixels;
+	pixels.reserve(target);
+
+	int64 total = (int64)image.total();
+
+	auto uniformPixel = [&]() {
+		int64 index = (int64)(rng.uniform(0.0, 1.0) * total);
+		index = std::min(index, total - 1);
+		return image.at<Vec3b>((int)(index / image.cols), (int)(index % image.cols));
+	};
+
+	if (stratified) {
+		// one jittered pixel from each cell of a grid laid over the image, so every region is represented
+		double cell = std::max(1.0, std::sqrt((double)image.total() / count));
+
+		for (double top = 0; top < image.rows; top += cell) {
+			for (double left = 0; left < image.cols; left += cell) {
+				int y = std::min(image.rows - 1, (int)(top + rng.uniform(0.0, cell)));
+				int x = std::min(image.cols - 1, (int)(left + rng.uniform(0.0, cell)));
+				pixels.push_back(image.at<Vec3b>(y, x));
+			}
+		}
+
+		randShuffle(pixels, 1.0, &rng);
+
+		if ((int)pixels.size() > target) {
+			pixels.resize(target);
+		}
+	}
+
+	// uniform draws for the random sample, or to top up a grid that came in under the packed size
+	while ((int)pixels.size() < target) {
+		pixels.push_back(uniformPixel());
+	}
+
+	Mat points(target / width, width, CV_8UC3);
+	std::memcpy(points.data, pixels.data(), (size_t)target * sizeof(Vec3b));
+
+	return points;
+}
+std::vector<Vec3f> KMeansEngine::seed(Mat image, int k, RNG& rng)
+{
+	// k means++ seeding on a uniform sample of pixels rather than the whole image
+	int total = (int)image.total();
+	int sampleCount = std::min(total, 4096);
+
+	std::vector<Vec3f> samples(sampleCount);
+	for (int i = 0; i < sampleCount; i++) {
+		int index = rng.uniform(0, total);
+		Vec3b pixel = image.at<Vec3b>(index / image.cols, index % image.cols);
+		samples[i] = Vec3f(pixel[0], pixel[1], pixel[2]);
+	}
+
+	return start(samples, std::vector<double>(sampleCount, 1.0), k, rng);
+}
+std::vector<Vec3f> KMeansEngine::start(const std::vector<Vec3f>& points, const std::vector<double>& weights, int k, RNG& rng)
+{
+	std::vector<Vec3f> centers = warmCenters;
+
+	// with more warm centers than wanted, the closest pair is merged into its weighted mean until k remain
+	if ((int)centers.size() > k) {
+		std::vector<double> sizes(centers.size(), 1.0);
+		if (warmCounts.size() == centers.size()) {
+			for (size_t j = 0; j < sizes.size(); j++) {
+				sizes[j] = std::max(1.0, (double)warmCounts[j]);
+			}
+		}
+
+		while ((int)centers.size() > k) {
+			size_t first = 0;
+			size_t second = 1;
+			double closest = DBL_MAX;
+
+			for (size_t a = 0; a < centers.size(); a++) {
+				for (size_t b = a + 1; b < centers.size(); b++) {
+					Vec3f delta = centers[a] - centers[b];
+					double distance = delta.dot(delta);
+
+					if (distance < closest) {
+						closest = distance;
+						first = a;
+						second = b;
+					}
+				}
+			}
+
+			double size = sizes[first] + sizes[second];
+			centers[first] = (centers[first] * (float)(sizes[first] / size)) + (centers[second] * (float)(sizes[second] / size));
+			sizes[first] = size;
+
+			centers.erase(centers.begin() + second);
+			sizes.erase(sizes.begin() + second);
+		}
+
+		return centers;
+	}
+
+	// otherwise k means++, keeping any warm centers and adding picks until k are chosen
+	int count = (int)points.size();
+	std::vector<double> distances(count, DBL_MAX);
+
+	for (const Vec3f& center : centers) {
+		for (int i = 0; i < count; i++) {
+			Vec3f delta = points[i] - center;
+			distances[i] = std::min(distances[i], (double)delta.dot(delta));
+		}
+	}
+
+	while ((int)centers.size() < k) {
+		// the first pick is weighted by count alone, later ones by count times squared distance
+		bool first = centers.empty();
+
+		double weight = 0;
+		for (int i = 0; i < count; i++) {
+			weight += (first ? 1.0 : distances[i]) * weights[i];
+		}
+
+		int chosen = 0;
+		if (weight > 0) {
+			double target = rng.uniform(0.0, weight);
+			while (chosen < count - 1 && target >= (first ? 1.0 : distances[chosen]) * weights[chosen]) {
+				target -= (first ? 1.0 : distances[chosen]) * weights[chosen];
+				chosen++;
+			}
+		}
+		else {
+			chosen = rng.uniform(0, count);
+		}
+
+		centers.push_back(points[chosen]);
+
+		for (int i = 0; i < count; i++) {
+			Vec3f delta = points[i] - points[chosen];
+			distances[i] = std::min(distances[i], (double)delta.dot(delta));
+		}
+	}
+
+	return centers;
+}
+double KMeansEngine::assign(Mat image, const std::vector<Vec3f>& centers, Mat& labels, std::vector<int64>& sums)
+{
+	int k = (int)centers.size();
+
+	// centers in 4 bit fixed point, so distances stay in 32 bit integers
+	std::vector<int> fixedCenters(k * 3);
+	for (int j = 0; j < k; j++) {
+		for (int c = 0; c < 3; c++) {
+			fixedCenters[j * 3 + c] = cvRound(centers[j][c] * 16);
+		}
+	}
+
+	labels.create(image.rows, image.cols, CV_8U);
+
+	// rows are split into stripes, each accumulating its own partial sums so the merge is deterministic
+	int stripes = std::max(1, std::min(image.rows, getNumThreads() * 4));
+	std::vector<std::vector<int64>> partialSums(stripes, std::vector<int64>(k * 4, 0));
+	std::vector<int64> partialDistortion(stripes, 0);
+
+	parallel_for_(Range(0, stripes), [&](const Range& range) {
+		for (int stripe = range.start; stripe < range.end; stripe++) {
+			int begin = (int)((int64)image.rows * stripe / stripes);
+			int end = (int)((int64)image.rows * (stripe + 1) / stripes);
+
+			for (int y = begin; y < end; y++) {
+				assignRow(image.ptr<uchar>(y), image.cols, fixedCenters.data(), k, labels.ptr<uchar>(y),
+					partialSums[stripe].data(), partialDistortion[stripe]);
+			}
+		}
+		});
+
+	sums.assign(k * 4, 0);
+	int64 distortion = 0;
+
+	for (int stripe = 0; stripe < stripes; stripe++) {
+		for (int i = 0; i < k * 4; i++) {
+			sums[i] += partialSums[stripe][i];
+		}
+		distortion += partialDistortion[stripe];
+	}
+
+	// back from fixed point to squared 8-bit units
+	return distortion / 256.0;
+}
+void KMeansEngine::assignRow(const uchar* pixels, int width, const int* fixedCenters, int k, uchar* labels, int64* sums, int64& distortion)
+{
+	int x = 0;
+
+#if defined(COR_AVX2) || defined(COR_SSE41)
+	// byte shuffles splitting 8 packed pixels into one vector per channel, read as bytes 0-15 and 16-23
+	const __m128i redLow = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i redHigh = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i greenLow = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i greenHigh = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i blueLow = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i blueHigh = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+#endif
+
+#if defined(COR_AVX2)
+	// per center channel sums and counts, kept in 32 bit lanes for the row and flushed at the end
+	__m256i accumulators[maxCenters][4];
+	for (int j = 0; j < k; j++) {
+		for (int c = 0; c < 4; c++) {
+			accumulators[j][c] = _mm256_setzero_si256();
+		}
+	}
+
+	alignas(32) int laneLabels[8];
+	alignas(32) int laneDistances[8];
+
+	for (; x + 8 <= width; x += 8) {
+		const uchar* p = pixels + x * 3;
+		__m128i low = _mm_loadu_si128((const __m128i*)p);
+		__m128i high = _mm_loadl_epi64((const __m128i*)(p + 16));
+
+		__m256i red = _mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(low, redLow), _mm_shuffle_epi8(high, redHigh)));
+		__m256i green = _mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(low, greenLow), _mm_shuffle_epi8(high, greenHigh)));
+		__m256i blue = _mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(low, blueLow), _mm_shuffle_epi8(high, blueHigh)));
+
+		__m256i redFixed = _mm256_slli_epi32(red, 4);
+		__m256i greenFixed = _mm256_slli_epi32(green, 4);
+		__m256i blueFixed = _mm256_slli_epi32(blue, 4);
+
+		__m256i best = _mm256_set1_epi32(INT_MAX);
+		__m256i label = _mm256_setzero_si256();
+
+		// nearest center by squared distance, ties keeping the lower index
+		for (int j = 0; j < k; j++) {
+			__m256i dr = _mm256_sub_epi32(redFixed, _mm256_set1_epi32(fixedCenters[j * 3]));
+			__m256i dg = _mm256_sub_epi32(greenFixed, _mm256_set1_epi32(fixedCenters[j * 3 + 1]));
+			__m256i db = _mm256_sub_epi32(blueFixed, _mm256_set1_epi32(fixedCenters[j * 3 + 2]));
+
+			__m256i distance = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(dr, dr), _mm256_mullo_epi32(dg, dg)), _mm256_mullo_epi32(db, db));
+			__m256i closer = _mm256_cmpgt_epi32(best, distance);
+
+			best = _mm256_min_epi32(best, distance);
+			label = _mm256_blendv_epi8(label, _mm256_set1_epi32(j), closer);
+		}
+
+		// masked centroid accumulation, the all ones mask doubling as a count of -1
+		for (int j = 0; j < k; j++) {
+			__m256i mask = _mm256_cmpeq_epi32(label, _mm256_set1_epi32(j));
+			accumulators[j][0] = _mm256_add_epi32(accumulators[j][0], _mm256_and_si256(mask, red));
+			accumulators[j][1] = _mm256_add_epi32(accumulators[j][1], _mm256_and_si256(mask, green));
+			accumulators[j][2] = _mm256_add_epi32(accumulators[j][2], _mm256_and_si256(mask, blue));
+			accumulators[j][3] = _mm256_sub_epi32(accumulators[j][3], mask);
+		}
+
+		_mm256_store_si256((__m256i*)laneLabels, label);
+		_mm256_store_si256((__m256i*)laneDistances, best);
+
+		for (int l = 0; l < 8; l++) {
+			labels[x + l] = (uchar)laneLabels[l];
+			distortion += laneDistances[l];
+		}
+	}
+
+	// flushing the lane sums into the 64 bit totals
+	alignas(32) int lanes[8];
+	for (int j = 0; j < k; j++) {
+		for (int c = 0; c < 4; c++) {
+			_mm256_store_si256((__m256i*)lanes, accumulators[j][c]);
+			for (int l = 0; l < 8; l++) {
+				sums[j * 4 + c] += lanes[l];
+			}
+		}
+	}
+#elif defined(COR_SSE41)
+	// per center channel sums and counts, kept in 32 bit lanes for the row and flushed at the end
+	__m128i accumulators[maxCenters][4];
+	for (int j = 0; j < k; j++) {
+		for (int c = 0; c < 4; c++) {
+			accumulators[j][c] = _mm_setzero_si128();
+		}
+	}
+
+	alignas(16) int laneLabels[4];
+	alignas(16) int laneDistances[4];
+
+	for (; x + 8 <= width; x += 8) {
+		const uchar* p = pixels + x * 3;
+		__m128i low = _mm_loadu_si128((const __m128i*)p);
+		__m128i high = _mm_loadl_epi64((const __m128i*)(p + 16));
+
+		__m128i redBytes = _mm_or_si128(_mm_shuffle_epi8(low, redLow), _mm_shuffle_epi8(high, redHigh));
+		__m128i greenBytes = _mm_or_si128(_mm_shuffle_epi8(low, greenLow), _mm_shuffle_epi8(high, greenHigh));
+		__m128i blueBytes = _mm_or_si128(_mm_shuffle_epi8(low, blueLow), _mm_shuffle_epi8(high, blueHigh));
+
+		// the 8 pixels are handled as two halves of 4 lanes each
+		for (int half = 0; half < 2; half++) {
+			__m128i red = _mm_cvtepu8_epi32(redBytes);
+			__m128i green = _mm_cvtepu8_epi32(greenBytes);
+			__m128i blue = _mm_cvtepu8_epi32(blueBytes);
+
+			redBytes = _mm_srli_si128(redBytes, 4);
+			greenBytes = _mm_srli_si128(greenBytes, 4);
+			blueBytes = _mm_srli_si128(blueBytes, 4);
+
+			__m128i redFixed = _mm_slli_epi32(red, 4);
+			__m128i greenFixed = _mm_slli_epi32(green, 4);
+			__m128i blueFixed = _mm_slli_epi32(blue, 4);
+
+			__m128i best = _mm_set1_epi32(INT_MAX);
+			__m128i label = _mm_setzero_si128();
+
+			// nearest center by squared distance, ties keeping the lower index
+			for (int j = 0; j < k; j++) {
+				__m128i dr = _mm_sub_epi32(redFixed, _mm_set1_epi32(fixedCenters[j * 3]));
+				__m128i dg = _mm_sub_epi32(greenFixed, _mm_set1_epi32(fixedCenters[j * 3 + 1]));
+				__m128i db = _mm_sub_epi32(blueFixed, _mm_set1_epi32(fixedCenters[j * 3 + 2]));
+
+				__m128i distance = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(dr, dr), _mm_mullo_epi32(dg, dg)), _mm_mullo_epi32(db, db));
+				__m128i closer = _mm_cmpgt_epi32(best, distance);
+
+				best = _mm_min_epi32(best, distance);
+				label = _mm_blendv_epi8(label, _mm_set1_epi32(j), closer);
+			}
+
+			// masked centroid accumulation, the all ones mask doubling as a count of -1
+			for (int j = 0; j < k; j++) {
+				__m128i mask = _mm_cmpeq_epi32(label, _mm_set1_epi32(j));
+				accumulators[j][0] = _mm_add_epi32(accumulators[j][0], _mm_and_si128(mask, red));
+				accumulators[j][1] = _mm_add_epi32(accumulators[j][1], _mm_and_si128(mask, green));
+				accumulators[j][2] = _mm_add_epi32(accumulators[j][2], _mm_and_si128(mask, blue));
+				accumulators[j][3] = _mm_sub_epi32(accumulators[j][3], mask);
+			}
+
+			_mm_store_si128((__m128i*)laneLabels, label);
+			_mm_store_si128((__m128i*)laneDistances, best);
+
+			for (int l = 0; l < 4; l++) {
+				labels[x + half * 4 + l] = (uchar)laneLabels[l];
+				distortion += laneDistances[l];
+			}
+		}
+	}
+
+	// flushing the lane sums into the 64 bit totals
+	alignas(16) int lanes[4];
+	for (int j = 0; j < k; j++) {
+		for (int c = 0; c < 4; c++) {
+			_mm_store_si128((__m128i*)lanes, accumulators[j][c]);
+			for (int l = 0; l < 4; l++) {
+				sums[j * 4 + c] += lanes[l];
+			}
+		}
+	}
+#endif
+
+	// scalar path for the remaining pixels, and the whole row without vector support
+	for (; x < width; x++) {
+		const uchar* p = pixels + x * 3;
+
+		int best = INT_MAX;
+		int label = 0;
+
+		for (int j = 0; j < k; j++) {
+			int dr = (p[0] << 4) - fixedCenters[j * 3];
+			int dg = (p[1] << 4) - fixedCenters[j * 3 + 1];
+			int db = (p[2] << 4) - fixedCenters[j * 3 + 2];
+			int distance = dr * dr + dg * dg + db * db;
+
+			if (distance < best) {
+				best = distance;
+				label = j;
+			}
+		}
+
+		labels[x] = (uchar)label;
+		distortion += best;
+
+		sums[label * 4] += p[0];
+		sums[label * 4 + 1] += p[1];
+		sums[label * 4 + 2] += p[2];
+		sums[label * 4 + 3] += 1;
+	}
+}
+double KMeansEngine::assignBounded(Mat image, const std::vector<Vec3f>& centers, Mat& labels, std::vector<int64>& sums, Bounds& bounds)
+{
+	int k = (int)centers.size();
+
+	std::vector<int> fixedCenters(k * 3);
+	for (int j = 0; j < k; j++) {
+		for (int c = 0; c < 3; c++) {
+			fixedCenters[j * 3 + c] = cvRound(centers[j][c] * 16);
+		}
+	}
+
+	// the first pass, or one after k or the points changed, scans every center and sets up the bounds
+	bool first = bounds.lower.size() != image.total() || bounds.fixedCenters.size() != fixedCenters.size() || labels.size() != image.size();
+
+	if (first) {
+		labels.create(image.rows, image.cols, CV_8U);
+		bounds.lower.assign(image.total(), 0.0f);
+	}
+
+	// how far each center moved, and so how much any lower bound on a distance to another center may drop
+	std::vector<float> lowerShift(k, 0.0f);
+	std::vector<float> halfSeparation(k, 0.0f);
+
+	if (!first) {
+		std::vector<double> shifts(k);
+		for (int j = 0; j < k; j++) {
+			double dr = fixedCenters[j * 3] - bounds.fixedCenters[j * 3];
+			double dg = fixedCenters[j * 3 + 1] - bounds.fixedCenters[j * 3 + 1];
+			double db = fixedCenters[j * 3 + 2] - bounds.fixedCenters[j * 3 + 2];
+			shifts[j] = std::sqrt(dr * dr + dg * dg + db * db);
+		}
+
+		for (int j = 0; j < k; j++) {
+			double largest = 0;
+			double closest = DBL_MAX;
+
+			for (int other = 0; other < k; other++) {
+				if (other == j) {
+					continue;
+				}
+
+				largest = std::max(largest, shifts[other]);
+
+				double dr = fixedCenters[j * 3] - fixedCenters[other * 3];
+				double dg = fixedCenters[j * 3 + 1] - fixedCenters[other * 3 + 1];
+				double db = fixedCenters[j * 3 + 2] - fixedCenters[other * 3 + 2];
+				closest = std::min(closest, std::sqrt(dr * dr + dg * dg + db * db));
+			}
+
+			lowerShift[j] = (float)largest;
+			halfSeparation[j] = (float)(closest == DBL_MAX ? FLT_MAX : closest / 2);
+		}
+	}
+
+	// same stripes as the standard pass, so the merged sums are identical
+	int stripes = std::max(1, std::min(image.rows, getNumThreads() * 4));
+	std::vector<std::vector<int64>> partialSums(stripes, std::vector<int64>(k * 4, 0));
+	std::vector<int64> partialDistortion(stripes, 0);
+
+	parallel_for_(Range(0, stripes), [&](const Range& range) {
+		for (int stripe = range.start; stripe < range.end; stripe++) {
+			int begin = (int)((int64)image.rows * stripe / stripes);
+			int end = (int)((int64)image.rows * (stripe + 1) / stripes);
+
+			for (int y = begin; y < end; y++) {
+				assignBoundedRow(image.ptr<uchar>(y), image.cols, fixedCenters.data(), k, halfSeparation.data(), lowerShift.data(), first,
+					labels.ptr<uchar>(y), bounds.lower.data() + (size_t)y * image.cols, partialSums[stripe].data(), partialDistortion[stripe]);
+			}
+		}
+		});
+
+	bounds.fixedCenters = fixedCenters;
+
+	sums.assign(k * 4, 0);
+	int64 distortion = 0;
+
+	for (int stripe = 0; stripe < stripes; stripe++) {
+		for (int i = 0; i < k * 4; i++) {
+			sums[i] += partialSums[stripe][i];
+		}
+		distortion += partialDistortion[stripe];
+	}
+
+	return distortion / 256.0;
+}
+void KMeansEngine::assignBoundedRow(const uchar* pixels, int width, const int* fixedCenters, int k, const float* halfSeparation, const float* lowerShift,
+	bool first, uchar* labels, float* lower, int64* sums, int64& distortion)
+{
+	// slack covering the rounding of the single precision bounds, in fixed point units
+	const float margin = 0.5f;
+
+	for (int x = 0; x < width; x++) {
+		const uchar* p = pixels + x * 3;
+		int label = labels[x];
+		int best;
+
+		// the exact distance to the current center is always needed, for the compactness
+		bool scan = first;
+
+		if (!first) {
+			int dr = (p[0] << 4) - fixedCenters[label * 3];
+			int dg = (p[1] << 4) - fixedCenters[label * 3 + 1];
+			int db = (p[2] << 4) - fixedCenters[label * 3 + 2];
+			best = dr * dr + dg * dg + db * db;
+
+			// the center is strictly the nearest when it is closer than every other center could have come,
+			// or closer than half the distance to its nearest neighbouring center
+			lower[x] -= lowerShift[label];
+			float upper = std::sqrt((float)best);
+
+			scan = upper + margin >= std::max(lower[x], halfSeparation[label]);
+		}
+
+		if (scan) {
+			// the same scan and tie breaking as the standard pass, also keeping the second closest distance
+			best = INT_MAX;
+			int second = INT_MAX;
+			label = 0;
+
+			for (int j = 0; j < k; j++) {
+				int dr = (p[0] << 4) - fixedCenters[j * 3];
+				int dg = (p[1] << 4) - fixedCenters[j * 3 + 1];
+				int db = (p[2] << 4) - fixedCenters[j * 3 + 2];
+				int distance = dr * dr + dg * dg + db * db;
+
+				if (distance < best) {
+					second = best;
+					best = distance;
+					label = j;
+				}
+				else if (distance < second) {
+					second = distance;
+				}
+			}
+
+			labels[x] = (uchar)label;
+			lower[x] = second == INT_MAX ? FLT_MAX : std::sqrt((float)second);
+		}
+
+		distortion += best;
+
+		sums[label * 4] += p[0];
+		sums[label * 4 + 1] += p[1];
+		sums[label * 4 + 2] += p[2];
+		sums[label * 4 + 3] += 1;
+	}
+}
+std::vector<Vec3b> KMeansEngine::palette(const std::vector<Vec3f>& centers)
+{
+	// rounding the centers once into an 8-bit palette
+	std::vector<Vec3b> colors(centers.size());
+	for (size_t j = 0; j < centers.size(); j++) {
+		colors[j] = Vec3b(saturate_cast<uchar>(centers[j][0]), saturate_cast<uchar>(centers[j][1]), saturate_cast<uchar>(centers[j][2]));
+	}
+
+	return colors;
+}
+
+
+IndexedImage::IndexedImage()
+{
+}
+IndexedImage::IndexedImage(Mat indices, std::vector<Vec3b> palette)
+{
+	this->indices = indices;
+	this->palette = palette;
+}
+bool IndexedImage::empty() const
+{
+	return indices.empty();
+}
+Mat IndexedImage::render() const
+{
+	return render(palette);
+}
+Mat IndexedImage::render(const std::vector<Vec3b>& colors) const
+{
+	Mat output(indices.rows, indices.cols, CV_8UC3);
+
+	// replace every index with its palette color, in parallel over rows
+	parallel_for_(Range(0, indices.rows), [&](const Range& range) {
+		for (int y = range.start; y < range.end; y++) {
+			renderRow(indices.ptr<uchar>(y), indices.cols, colors.data(), (int)colors.size(), output.ptr<uchar>(y));
+		}
+		});
+
+	return output;
+}
+void IndexedImage::renderRow(const uchar* indices, int width, const Vec3b* colors, int size, uchar* pixels)
+{
+	int x = 0;
+
+#if defined(COR_AVX2) || defined(COR_SSE41)
+	if (size <= 16) {
+		// one 16 entry table per channel, so a byte shuffle looks up 16 indices at once
+		alignas(16) uchar tables[3][16] = {};
+		for (int j = 0; j < size; j++) {
+			for (int c = 0; c < 3; c++) {
+				tables[c][j] = colors[j][c];
+			}
+		}
+
+		// shuffles interleaving the three looked up channels back into 48 packed bytes
+		alignas(16) char masks[3][3][16];
+		for (int block = 0; block < 3; block++) {
+			for (int c = 0; c < 3; c++) {
+				for (int b = 0; b < 16; b++) {
+					int byte = block * 16 + b;
+					masks[block][c][b] = (byte % 3 == c) ? (char)(byte / 3) : (char)-1;
+				}
+			}
+		}
+
+		__m128i red = _mm_load_si128((const __m128i*)tables[0]);
+		__m128i green = _mm_load_si128((const __m128i*)tables[1]);
+		__m128i blue = _mm_load_si128((const __m128i*)tables[2]);
+
+		for (; x + 16 <= width; x += 16) {
+			__m128i index = _mm_loadu_si128((const __m128i*)(indices + x));
+
+			__m128i r = _mm_shuffle_epi8(red, index);
+			__m128i g = _mm_shuffle_epi8(green, index);
+			__m128i b = _mm_shuffle_epi8(blue, index);
+
+			for (int block = 0; block < 3; block++) {
+				__m128i packed = _mm_or_si128(_mm_or_si128(
+					_mm_shuffle_epi8(r, _mm_load_si128((const __m128i*)masks[block][0])),
+					_mm_shuffle_epi8(g, _mm_load_si128((const __m128i*)masks[block][1]))),
+					_mm_shuffle_epi8(b, _mm_load_si128((const __m128i*)masks[block][2])));
+
+				_mm_storeu_si128((__m128i*)(pixels + x * 3 + block * 16), packed);
+			}
+		}
+	}
+#endif
+
+	// scalar lookup for the remaining pixels and for larger palettes
+	for (; x < width; x++) {
+		const Vec3b& color = colors[indices[x]];
+		pixels[x * 3] = color[0];
+		pixels[x * 3 + 1] = color[1];
+		pixels[x * 3 + 2] = color[2];
+	}
+}
+
+
+Vec3b Palette::target(const Vec3b& color) const
+{
+	std::vector<Vec3b>::const_iterator iterator = std::find(sourceColors.begin(), sourceColors.end(), color);
+
+	if (iterator == sourceColors.end()) {
+		return color;
+	}
+
+	size_t index = std::distance(sourceColors.begin(), iterator);
+
+	if (index >= targetColors.size()) {
+		return color;
+	}
+
+	return targetColors[index];
+}
+std::vector<Vec3b> Palette::remap(const std::vector<Vec3b>& colors) const
+{
+	std::vector<Vec3b> output(colors.size());
+	for (size_t i = 0; i < colors.size(); i++) {
+		output[i] = target(colors[i]);
+	}
+
+	return output;
+}
+
+
+PaletteModel::PaletteModel(QObject* parent) : QObject(parent)
+{
+}
+void PaletteModel::setSourceColors(std::vector<Vec3b> colors)
+{
+	// targets the user reassigned are kept by position, the rest follow their new source color
+	std::vector<Vec3b> targets(colors.size());
+
+	for (size_t i = 0; i < colors.size(); i++) {
+		bool reassigned = i < palette.sourceColors.size() && i < palette.targetColors.size()
+			&& palette.targetColors[i] != palette.sourceColors[i];
+
+		targets[i] = reassigned ? palette.targetColors[i] : colors[i];
+	}
+
+	// a rerun finding the same clusters, such as after a pixelation change, is not a change
+	if (colors == palette.sourceColors && targets == palette.targetColors) {
+		return;
+	}
+
+	palette.sourceColors = colors;
+	palette.targetColors = targets;
+	palette.version++;
+
+	emit changed();
+}
+void PaletteModel::setTargetColor(int index, Vec3b color)
+{
+	if (index < 0 || index >= (int)palette.targetColors.size() || palette.targetColors[index] == color) {
+		return;
+	}
+
+	palette.targetColors[index] = color;
+	palette.version++;
+
+	emit changed();
+}
+
+
+StageCache::StageCache(size_t capacity)
+{
+	this->capacity = capacity;
+}
+bool StageCache::find(uint64 key, Entry& entry)
+{
+	QMutexLocker locker(&mutex);
+
+	for (auto found = entries.begin(); found != entries.end(); found++) {
+		if (found->key == key) {
+			// moving the hit to the front of the list as most recently used
+			entries.splice(entries.begin(), entries, found);
+			entry = entries.front();
+			return true;
+		}
+	}
+
+	return false;
+}
+void StageCache::insert(Entry entry)
+{
+	QMutexLocker locker(&mutex);
+
+	// a concurrent run may have computed the same stage already
+	for (auto found = entries.begin(); found != entries.end(); found++) {
+		if (found->key == entry.key) {
+			entries.erase(found);
+			break;
+		}
+	}
+
+	entries.push_front(entry);
+
+	while (entries.size() > capacity) {
+		entries.pop_back();
+	}
+}
+void StageCache::clear()
+{
+	QMutexLocker locker(&mutex);
+	entries.clear();
+}
+uint64 StageCache::combine(uint64 seed, uint64 value)
+{
+	// splitmix64 finalizer over the running key and the value
+	uint64 x = seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+uint64 StageCache::combine(uint64 seed, const void* data, size_t bytes)
+{
+	const uchar* byte = static_cast<const uchar*>(data);
+
+	seed = combine(seed, (uint64)bytes);
+	for (size_t i = 0; i < bytes; i += 8) {
+		uint64 word = 0;
+		std::memcpy(&word, byte + i, std::min<size_t>(8, bytes - i));
+		seed = combine(seed, word);
+	}
+
+	return seed;
+}
+
+
+ImagePipeline::ImagePipeline(ImageCache* cache)
+{
+	this->cache = cache;
+	kMeansDerivation = 0;
+
+	// working set of full resolution exports in megabytes, 'COR_TILE_MB' overrides
+	tileBudget = (size_t)64 * 1024 * 1024;
+
+	bool tileSet = false;
+	int tileMegabytes = qEnvironmentVariableIntValue("COR_TILE_MB", &tileSet);
+
+	if (tileSet && tileMegabytes > 0) {
+		tileBudget = (size_t)tileMegabytes * 1024 * 1024;
+	}
+
+	// k means fits its centers on a stratified sample by default, 'COR_KMEANS_SAMPLING' and 'COR_KMEANS_SAMPLES' override
+	kMeansSampling = KMeansEngine::Stratified;
+	kMeansSamples = 65536;
+
+	QString sampling = qEnvironmentVariable("COR_KMEANS_SAMPLING").toLower();
+
+	if (sampling == "full") {
+		kMeansSampling = KMeansEngine::Full;
+	}
+	else if (sampling == "random") {
+		kMeansSampling = KMeansEngine::Random;
+	}
+	else if (sampling == "minibatch") {
+		kMeansSampling = KMeansEngine::MiniBatch;
+	}
+	else if (sampling == "histogram") {
+		kMeansSampling = KMeansEngine::Histogram;
+	}
+
+	// bits per channel of the histogram mode, 8 for exact colors, 'COR_KMEANS_HISTOGRAM_BITS' overrides
+	kMeansHistogramBits = 6;
+
+	bool bitsSet = false;
+	int bits = qEnvironmentVariableIntValue("COR_KMEANS_HISTOGRAM_BITS", &bitsSet);
+
+	if (bitsSet && bits >= 1 && bits <= 8) {
+		kMeansHistogramBits = bits;
+	}
+
+	bool samplesSet = false;
+	int samples = qEnvironmentVariableIntValue("COR_KMEANS_SAMPLES", &samplesSet);
+
+	if (samplesSet && samples > 0) {
+		kMeansSamples = samples;
+	}
+
+	// standard lloyd passes unless 'COR_KMEANS_ALGORITHM' asks for the bounded ones
+	kMeansAlgorithm = KMeansEngine::Lloyd;
+
+	if (qEnvironmentVariable("COR_KMEANS_ALGORITHM").toLower() == "hamerly") {
+		kMeansAlgorithm = KMeansEngine::Hamerly;
+	}
+
+	// k means seed, 'COR_KMEANS_SEED' setting one that also turns off warm starts for reproducible runs
+	KMeansEngine defaults;
+	kMeansSeed = defaults.randomSeed;
+
+	bool seedParsed = false;
+	qulonglong seedValue = qEnvironmentVariable("COR_KMEANS_SEED").toULongLong(&seedParsed, 0);
+
+	kMeansSeeded = seedParsed;
+	if (seedParsed) {
+		kMeansSeed = seedValue;
+	}
+
+	// clustering the pixelated grid instead of every pixel when both are on, 'COR_PIPELINE_REORDER=0' turns this off
+	bool reorderSet = false;
+	int reorderValue = qEnvironmentVariableIntValue("COR_PIPELINE_REORDER", &reorderSet);
+	reorder = !reorderSet || reorderValue != 0;
+}
+PipelineResult ImagePipeline::run(PipelineRequest request, std::shared_ptr<std::atomic_bool> cancelled, std::function<void(int)> progress)
+{
+	PipelineResult result;
+	result.imagePath = request.imagePath;
+	result.completed = false;
+	result.clustered = false;
+
+	TraceScope trace("pipeline", Size(), { { "kmeans", request.kmeans }, { "pixelate", request.pixelate }, { "hues", request.hues }, { "preview", request.preview } });
+
+	// progress is optional, batch runs report throughput instead
+	auto report = [&progress](int value) {
+		if (progress) {
+			progress(value);
+		}
+	};
+
+	// initializing the image from the file text, as a proxy no larger than the picture frame when previewing
+	Mat image;
+	{
+		TraceScope decode("decode", Size(), { { "preview", request.preview } });
+
+		if (request.preview) {
+			image = proxy(request.imagePath, request.display);
+		}
+		else {
+			image = source(request.imagePath);
+		}
+
+		decode.annotate(image.size());
+	}
+
+	// nothing to display when the path could not be decoded
+	if (image.empty() || cancelled->load()) {
+		return result;
+	}
+
+	result.source = image.size();
+	trace.annotate(image.size());
+
+	report(20);
+
+	// with both k means and pixelation on, the planner clusters the block means instead of every pixel,
+	// a grid of at most factor by factor samples, and expands the clustered grid afterwards
+	bool planned = request.kmeans && request.pixelate && reorder;
+
+	// full resolution exports stream over strips instead of materializing every stage
+	if (!request.exportPath.empty()) {
+		std::vector<Vec3f> centers = request.centers;
+
+		// the grid is small enough to cluster at full resolution, so no proxy is needed
+		if (planned) {
+			IndexedImage output;
+			{
+				TraceScope gridded("grid render", image.size(), { { "k", request.k }, { "factor", request.pixFactor } });
+
+				IndexedImage grid = gridImage(image, request, centers);
+				if (request.hues) {
+					grid = huesImage(grid, request.palette);
+				}
+
+				// expanding the indices rather than rendered pixels, a third of the bytes
+				output = IndexedImage(expandBlocks(grid.indices, request.pixStretch ? Size(image.cols, image.cols) : image.size()), grid.palette);
+			}
+
+			if (cancelled->load()) {
+				return result;
+			}
+
+			report(90);
+
+			TraceScope encode("encode", output.indices.size());
+			result.completed = writeImage(request.exportPath, output);
+			return result;
+		}
+
+		// without a cache the proxy is scaled from the source already decoded rather than decoded again
+		if (request.kmeans && centers.empty()) {
+			Mat fit = cache ? proxy(request.imagePath, request.display) : fitted(image, request.display);
+
+			TraceScope fitting("kmeans fit", fit.size(), { { "k", request.k } });
+			kMeansImage(fit, request, centers);
+		}
+
+		if (cancelled->load()) {
+			return result;
+		}
+
+		// unpixelated k means stays an index plane with the recolored palette, written with a color table
+		if (request.kmeans && !request.pixelate) {
+			IndexedImage output;
+			{
+				TraceScope tiled("tiled labels", image.size(), { { "k", request.k } });
+				output = tiledIndices(image, request, centers, cancelled);
+			}
+
+			if (output.empty()) {
+				return result;
+			}
+
+			report(90);
+
+			TraceScope encode("encode", output.indices.size());
+			result.completed = writeImage(request.exportPath, output);
+			return result;
+		}
+
+		Mat output;
+		{
+			TraceScope tiled("tiled render", image.size(), { { "k", request.k }, { "factor", request.pixFactor } });
+			output = tiledImage(image, request, centers, cancelled);
+		}
+
+		if (output.empty()) {
+			return result;
+		}
+
+		report(90);
+
+		TraceScope encode("encode", output.size());
+		result.completed = imwrite(request.exportPath, output);
+		return result;
+	}
+
+	// k means output kept as indices and palette while it is still the current image, 'image' then being left empty
+	IndexedImage indexed;
+
+	// every stage result is memoized under its input's key and its own parameters, so only stages
+	// downstream of a change are recomputed, the held source keeping its buffer from being reused
+	Mat source = image;
+	uint64 key = StageCache::combine(StageCache::combine(0, (uint64)(uintptr_t)image.data), (uint64)image.cols << 32 | (uint64)image.rows);
+	StageCache::Entry entry;
+
+	if (planned) {
+		key = StageCache::combine(key, StageCache::Grid);
+		key = StageCache::combine(key, (uint64)request.pixFactor << 2 | (uint64)request.pixAspect << 1 | (uint64)request.pixStretch);
+		key = StageCache::combine(key, (uint64)request.k << 32 | (uint64)request.sampling);
+		key = StageCache::combine(key, (uint64)request.samples << 32 | (uint64)request.histogramBits);
+		key = StageCache::combine(key, request.seed);
+		key = StageCache::combine(key, (uint64)request.autoK);
+		key = StageCache::combine(key, request.centers.data(), request.centers.size() * sizeof(Vec3f));
+
+		IndexedImage grid;
+
+		if (stages.find(key, entry)) {
+			grid = entry.indexed;
+			result.centers = entry.centers;
+			result.colors = entry.colors;
+			result.inertia = entry.inertia;
+		}
+		else {
+			std::vector<Vec3f> centers = request.centers;
+
+			{
+				TraceScope clustering("grid kmeans", image.size(), { { "k", request.k }, { "factor", request.pixFactor }, { "auto", request.autoK } });
+				grid = gridImage(image, request, centers, &result.inertia);
+			}
+
+			result.centers = centers;
+			result.colors = gatherColors(grid);
+
+			if (cancelled->load()) {
+				return result;
+			}
+
+			stages.insert({ key, source, Mat(), grid, result.centers, result.colors, result.inertia });
+		}
+
+		result.clustered = true;
+
+		report(60);
+
+		// recoloring the grid's palette, then expanding to the pixelated size with the same block mapping
+		if (request.hues) {
+			grid = huesImage(grid, request.palette);
+		}
+
+		// expanding the indices, so the output stays indexed all the way to the display
+		TraceScope expansion("expand", image.size(), { { "factor", request.pixFactor }, { "stretch", request.pixStretch } });
+		indexed = IndexedImage(expandBlocks(grid.indices, request.pixStretch ? Size(image.cols, image.cols) : image.size()), grid.palette);
+		image = Mat();
+	}
+
+	// switch logic, checking for cancellation between stages
+	if (request.kmeans && !planned) {
+		key = StageCache::combine(key, StageCache::KMeans);
+		key = StageCache::combine(key, (uint64)request.k << 32 | (uint64)request.sampling);
+		key = StageCache::combine(key, (uint64)request.samples << 32 | (uint64)request.histogramBits);
+		key = StageCache::combine(key, request.seed);
+		key = StageCache::combine(key, (uint64)request.autoK);
+		key = StageCache::combine(key, request.centers.data(), request.centers.size() * sizeof(Vec3f));
+
+		if (stages.find(key, entry)) {
+			indexed = entry.indexed;
+			image = entry.image;
+			result.centers = entry.centers;
+			result.colors = entry.colors;
+			result.inertia = entry.inertia;
+			result.clustered = true;
+		}
+		else {
+			std::vector<Vec3f> centers = request.centers;
+
+			// k means algorithm, its output kept as indices only
+			{
+				TraceScope clustering("kmeans", image.size(), { { "k", request.k }, { "sampling", request.sampling }, { "auto", request.autoK } });
+				indexed = kMeansImage(image, request, centers, &result.inertia);
+				image = Mat();
+			}
+
+			result.centers = centers;
+
+			// gathers the colors of the clusters produced by the kmeans algorithm
+			{
+				TraceScope gathering("gatherColors", indexed.indices.size(), { { "k", request.k } });
+				result.colors = gatherColors(indexed);
+				result.clustered = true;
+			}
+
+			if (cancelled->load()) {
+				return result;
+			}
+
+			stages.insert({ key, source, Mat(), indexed, result.centers, result.colors, result.inertia });
+		}
+	}
+
+	report(60);
+
+	if (request.pixelate && !planned) {
+		key = StageCache::combine(key, StageCache::Pixelate);
+		key = StageCache::combine(key, (uint64)request.pixFactor << 2 | (uint64)request.pixAspect << 1 | (uint64)request.pixStretch);
+
+		if (stages.find(key, entry)) {
+			image = entry.image;
+		}
+		else {
+			// k means indices are rendered first, as block means no longer map onto them
+			Mat pixels = indexed.empty() ? image : indexed.render();
+
+			// pixealtion interpolation
+			TraceScope pixelation("pixelate", pixels.size(), { { "factor", request.pixFactor }, { "stretch", request.pixStretch }, { "aspect", request.pixAspect } });
+			image = pixelateImage(pixels, request.pixFactor, request.pixStretch, request.pixAspect);
+
+			if (cancelled->load()) {
+				return result;
+			}
+
+			stages.insert({ key, source, image });
+		}
+
+		// pixelation comes out of either branch as plain pixels
+		indexed = IndexedImage();
+	}
+
+	report(75);
+
+	if (request.hues && !planned) {
+		// keyed on the palette's contents, so switching back to an earlier recolor is a hit as well
+		key = StageCache::combine(key, StageCache::Hues);
+		key = StageCache::combine(key, request.palette.sourceColors.data(), request.palette.sourceColors.size() * sizeof(Vec3b));
+		key = StageCache::combine(key, request.palette.targetColors.data(), request.palette.targetColors.size() * sizeof(Vec3b));
+
+		if (stages.find(key, entry)) {
+			image = entry.image;
+			indexed = entry.indexed;
+		}
+		else {
+			// recoloring is only a palette swap when the indices are still valid, the pixels never being touched
+			TraceScope recolor("hues", indexed.empty() ? image.size() : indexed.indices.size(), { { "colors", (double)request.palette.sourceColors.size() }, { "indexed", !indexed.empty() } });
+
+			if (!indexed.empty()) {
+				indexed = huesImage(indexed, request.palette);
+			}
+			else {
+				image = huesImage(image, request.palette);
+			}
+
+			if (cancelled->load()) {
+				return result;
+			}
+
+			stages.insert({ key, source, image, indexed });
+		}
+	}
+
+	report(90);
+
+	// handed over at the resolution it was processed at, the viewer fitting and zooming it
+	result.image = image;
+	result.indexed = indexed;
+	result.completed = true;
+
+	report(100);
+
+	return result;
+}
+Mat ImagePipeline::source(String imagePath)
+{
+	// full resolution decode, shared with the cache when there is one and so never to be written in place
+	if (cache) {
+		return cache->source(imagePath);
+	}
+
+	return imread(imagePath);
+}
+Mat ImagePipeline::proxy(String imagePath, Size bounds)
+{
+	if (cache) {
+		return cache->scaled(imagePath, bounds.width, bounds.height);
+	}
+
+	return fitted(imread(imagePath), bounds);
+}
+Mat ImagePipeline::fitted(Mat image, Size bounds)
+{
+	if (image.empty()) {
+		return image;
+	}
+
+	double factor = std::min((double)bounds.width / image.cols, (double)bounds.height / image.rows);
+
+	if (factor <= 0 || factor >= 1.0) {
+		return image;
+	}
+
+	Mat output;
+	Size target(std::max(1, (int)(image.cols * factor)), std::max(1, (int)(image.rows * factor)));
+	cv::resize(image, output, target, 0, 0, INTER_AREA);
+
+	return output;
+}
+QImage ImagePipeline::imageFormat(Mat image)
+{
+	// wraps the Mat's pixels without copying, the image holds a reference to the matrix until Qt releases it
+	Mat* held = new Mat(image);
+	return QImage(held->data, held->cols, held->rows, (int)held->step, QImage::Format_BGR888,
+		[](void* info) { delete static_cast<Mat*>(info); }, held);
+}
+QImage ImagePipeline::imageFormat(IndexedImage image)
+{
+	// wraps the index plane without copying, with the palette as the color table in qt's 'rgb' order
+	Mat* held = new Mat(image.indices);
+	QImage output(held->data, held->cols, held->rows, (int)held->step, QImage::Format_Indexed8,
+		[](void* info) { delete static_cast<Mat*>(info); }, held);
+
+	QVector<QRgb> table((int)image.palette.size());
+	for (int i = 0; i < table.size(); i++) {
+		const Vec3b& c = image.palette[i];
+		table[i] = qRgb(c[2], c[1], c[0]);
+	}
+
+	output.setColorTable(table);
+	return output;
+}
+bool ImagePipeline::writeImage(String path, IndexedImage image)
+{
+	// formats with palettes are written by qt as indices and a color table, the rest rendered and encoded by OpenCV
+	QString suffix = QFileInfo(QString::fromStdString(path)).suffix().toLower();
+
+	if (suffix == "png" || suffix == "bmp") {
+		return imageFormat(image).save(QString::fromStdString(path));
+	}
+
+	return imwrite(path, image.render());
+}
+IndexedImage ImagePipeline::kMeansImage(Mat image, const PipelineRequest& request, std::vector<Vec3f>& centers, std::vector<double>* inertia,
+	Mat origin, uint64 derivation)
+{
+	// label initialization for the clustering output
+	Mat labels;
+
+	// kmeans algorithm execution directly on the 8-bit pixels, 10 iterations, epsilon 1.0 and 3 attempts
+	KMeansEngine engine(10, 1.0, 3);
+	engine.sampling = request.sampling;
+	engine.sampleSize = request.samples;
+	engine.histogramBits = request.histogramBits;
+	engine.randomSeed = request.seed;
+	engine.algorithm = request.algorithm;
+
+	// images beyond the working set budget are fitted tile by tile
+	if ((size_t)image.total() * 4 > request.tileBudget) {
+		engine.tileRows = (int)std::max<int64>(1, (int64)(request.tileBudget / ((size_t)image.cols * 4)));
+	}
+
+	// centers already fitted, on the proxy, only need one labelling pass
+	if (!centers.empty()) {
+		engine.label(image, centers, labels);
+		return IndexedImage(labels, KMeansEngine::palette(centers));
+	}
+
+	if (origin.empty()) {
+		origin = image;
+	}
+
+	// seeding from the previous centers when the source is unchanged and only k or the recolor differ,
+	// unless a seed was set, since the result would then depend on the runs before it
+	kMeansMutex.lock();
+	if (!request.seeded && kMeansSource.data == origin.data && kMeansSource.size() == origin.size() && kMeansDerivation == derivation) {
+		engine.warmCenters = kMeansCenters;
+		engine.warmCounts = kMeansCounts;
+	}
+	kMeansMutex.unlock();
+
+	// automatic k sweeps every k up to the requested one and keeps the elbow of the inertia curve
+	if (request.autoK) {
+		std::vector<double> curve;
+		engine.sweep(image, request.k, labels, centers, curve);
+
+		if (inertia) {
+			*inertia = curve;
+		}
+	}
+	else {
+		engine.cluster(image, request.k, labels, centers);
+	}
+
+	// remembering this result, the held source keeping its buffer from being reused by another image
+	kMeansMutex.lock();
+	kMeansSource = origin;
+	kMeansDerivation = derivation;
+	kMeansCenters = centers;
+	kMeansCounts = engine.counts;
+	kMeansMutex.unlock();
+
+	// retaining the labels as an index image alongside the palette of centers
+	return IndexedImage(labels, KMeansEngine::palette(centers));
+}
+IndexedImage ImagePipeline::gridImage(Mat image, const PipelineRequest& request, std::vector<Vec3f>& centers, std::vector<double>* inertia)
+{
+	// block means of the image, the pixelation kernel writing one pixel per block
+	Size grid = pixelGrid(image.size(), request.pixFactor, request.pixAspect && !request.pixStretch);
+	Mat means(grid, CV_8UC3);
+	pixelate(image, grid, means);
+
+	// clustering the means, or only labelling them against centers fitted earlier, the means being new on
+	// every run, so warm starts are keyed on the image they were taken from and the grid size
+	return kMeansImage(means, request, centers, inertia, image, (uint64)grid.width << 32 | (uint64)grid.height);
+}
+Mat ImagePipeline::expandBlocks(Mat grid, Size size)
+{
+	// nearest neighbour expansion with the pixelation's block mapping, one row built per block row and copied
+	Mat output(size, grid.type());
+	size_t pixelBytes = grid.elemSize();
+
+	std::vector<int> blockOfColumn(size.width);
+	for (int x = 0; x < size.width; x++) {
+		blockOfColumn[x] = (int)((int64)x * grid.cols / size.width);
+	}
+
+	parallel_for_(Range(0, grid.rows), [&](const Range& range) {
+		for (int block = range.start; block < range.end; block++) {
+			int top = (int)(((int64)block * size.height + grid.rows - 1) / grid.rows);
+			int bottom = (int)(((int64)(block + 1) * size.height + grid.rows - 1) / grid.rows);
+
+			if (top >= bottom) {
+				continue;
+			}
+
+			const uchar* cells = grid.ptr<uchar>(block);
+			uchar* row = output.ptr<uchar>(top);
+
+			for (int x = 0; x < size.width; x++) {
+				std::memcpy(row + x * pixelBytes, cells + blockOfColumn[x] * pixelBytes, pixelBytes);
+			}
+
+			for (int y = top + 1; y < bottom; y++) {
+				std::memcpy(output.ptr<uchar>(y), row, size.width * pixelBytes);
+			}
+		}
+		});
+
+	return output;
+}
+IndexedImage ImagePipeline::tiledIndices(Mat source, const PipelineRequest& request, const std::vector<Vec3f>& centers, std::shared_ptr<std::atomic_bool> cancelled)
+{
+	// strip height from the working set budget, counting a label and a converted copy per pixel
+	int tileRows = (int)std::max<int64>(1, (int64)(request.tileBudget / ((size_t)source.cols * 4)));
+
+	KMeansEngine engine;
+	std::vector<Vec3b> palette = KMeansEngine::palette(centers);
+
+	// recoloring is a palette swap, the indices themselves never change
+	if (request.hues) {
+		palette = request.palette.remap(palette);
+	}
+
+	Mat indices(source.rows, source.cols, CV_8U);
+	Mat tileLabels;
+
+	for (int top = 0; top < source.rows; top += tileRows) {
+		if (cancelled->load()) {
+			return IndexedImage();
+		}
+
+		Range rows(top, std::min(source.rows, top + tileRows));
+		engine.label(source.rowRange(rows), centers, tileLabels);
+		tileLabels.copyTo(indices.rowRange(rows));
+	}
+
+	return IndexedImage(indices, palette);
+}
+Mat ImagePipeline::tiledImage(Mat source, const PipelineRequest& request, const std::vector<Vec3f>& centers, std::shared_ptr<std::atomic_bool> cancelled)
+{
+	// strip height from the working set budget, counting a label and a converted copy per pixel
+	int tileRows = (int)std::max<int64>(1, (int64)(request.tileBudget / ((size_t)source.cols * 4)));
+
+	KMeansEngine engine;
+	std::vector<Vec3b> palette = KMeansEngine::palette(centers);
+
+	int outputRows = (request.pixelate && request.pixStretch) ? source.cols : source.rows;
+	Mat output(outputRows, source.cols, CV_8UC3);
+
+	Mat tileLabels;
+
+	if (!request.pixelate) {
+		for (int top = 0; top < source.rows; top += tileRows) {
+			if (cancelled->load()) {
+				return Mat();
+			}
+
+			Range rows(top, std::min(source.rows, top + tileRows));
+			Mat tile = source.rowRange(rows);
+			Mat target = output.rowRange(rows);
+			Mat strip;
+
+			if (request.hues) {
+				strip = huesImage(tile, request.palette);
+			}
+			else {
+				strip = tile;
+			}
+
+			strip.copyTo(target);
+		}
+
+		return output;
+	}
+
+	// pixelation streams one row of blocks at a time, a pixel belonging to block floor(position * blocks / size)
+	Size grid = pixelGrid(source.size(), request.pixFactor, request.pixAspect && !request.pixStretch);
+	std::vector<int> blockOfColumn(source.cols);
+	for (int x = 0; x < source.cols; x++) {
+		blockOfColumn[x] = (int)((int64)x * grid.width / source.cols);
+	}
+
+	std::vector<int64> sums(grid.width * 4);
+	std::vector<Vec3b> blocks(grid.width);
+
+	for (int block = 0; block < grid.height; block++) {
+		if (cancelled->load()) {
+			return Mat();
+		}
+
+		// source rows of this block row, summed strip by strip, falling back to the nearest row when upscaling
+		Range sourceRows = blockSpan(block, grid.height, source.rows);
+
+		std::fill(sums.begin(), sums.end(), 0);
+
+		for (int top = sourceRows.start; top < sourceRows.end; top += tileRows) {
+			Mat tile = source.rowRange(top, std::min(sourceRows.end, top + tileRows));
+
+			if (request.kmeans) {
+				engine.label(tile, centers, tileLabels);
+			}
+
+			for (int y = 0; y < tile.rows; y++) {
+				const Vec3b* pixel = tile.ptr<Vec3b>(y);
+				const uchar* label = request.kmeans ? tileLabels.ptr<uchar>(y) : nullptr;
+
+				for (int x = 0; x < tile.cols; x++) {
+					const Vec3b& color = request.kmeans ? palette[label[x]] : pixel[x];
+					int64* sum = &sums[blockOfColumn[x] * 4];
+
+					sum[0] += color[0];
+					sum[1] += color[1];
+					sum[2] += color[2];
+					sum[3] += 1;
+				}
+			}
+		}
+
+		// block means, recolored after pixelation like the untiled pipeline
+		for (int column = 0; column < grid.width; column++) {
+			int64* sum = &sums[column * 4];
+			int64 count = std::max<int64>(1, sum[3]);
+
+			Vec3b mean((uchar)((sum[0] + count / 2) / count), (uchar)((sum[1] + count / 2) / count), (uchar)((sum[2] + count / 2) / count));
+			blocks[column] = request.hues ? request.palette.target(mean) : mean;
+		}
+
+		// expanding the block row into its output rows
+		int outputTop = (int)(((int64)block * outputRows + grid.height - 1) / grid.height);
+		int outputBottom = (int)(((int64)(block + 1) * outputRows + grid.height - 1) / grid.height);
+
+		for (int y = outputTop; y < outputBottom; y++) {
+			Vec3b* pixel = output.ptr<Vec3b>(y);
+
+			for (int x = 0; x < source.cols; x++) {
+				const Vec3b& color = blocks[blockOfColumn[x]];
+				pixel[x] = color;
+			}
+		}
+	}
+
+	return output;
+}
+Mat ImagePipeline::pixelateImage(Mat image, int factor, bool stretch, bool aspect, bool inPlace)
+{
+	// stretched output is a square of the image's width in a square grid, otherwise the image keeps its size
+	// and the grid is either square or follows the aspect ratio so the blocks come out square
+	Size grid = pixelGrid(image.size(), factor, aspect && !stretch);
+	Size size = stretch ? Size(image.cols, image.cols) : image.size();
+
+	// writing over the source only when the caller owns it, the size is unchanged and every block covers at least
+	// one source row and column, since upscaled blocks read their nearest row, which other stripes may be overwriting
+	Mat output;
+	if (inPlace && size == image.size() && grid.width <= image.cols && grid.height <= image.rows) {
+		output = image;
+	}
+	else {
+		output.create(size, CV_8UC3);
+	}
+
+	pixelate(image, grid, output);
+
+	return output;
+}
+Size ImagePipeline::pixelGrid(Size image, int factor, bool aspect)
+{
+	factor = std::max(1, factor);
+
+	if (!aspect) {
+		return Size(factor, factor);
+	}
+
+	// the longer side gets 'factor' blocks and the shorter side proportionally fewer
+	if (image.width >= image.height) {
+		return Size(factor, std::max(1, (int)std::lround((double)factor * image.height / image.width)));
+	}
+
+	return Size(std::max(1, (int)std::lround((double)factor * image.width / image.height)), factor);
+}
+Range ImagePipeline::blockSpan(int block, int blocks, int size)
+{
+	// positions p with floor(p * blocks / size) == block, falling back to the nearest position when upscaling
+	int start = (int)(((int64)block * size + blocks - 1) / blocks);
+	int end = (int)(((int64)(block + 1) * size + blocks - 1) / blocks);
+
+	if (start >= end) {
+		start = std::min(size - 1, (int)((int64)block * size / blocks));
+		end = start + 1;
+	}
+
+	return Range(start, end);
+}
+void ImagePipeline::pixelate(Mat image, Size grid, Mat output)
+{
+	// source columns of every block column, and the block column of every output column
+	std::vector<Range> columns(grid.width);
+	for (int column = 0; column < grid.width; column++) {
+		columns[column] = blockSpan(column, grid.width, image.cols);
+	}
+
+	std::vector<int> blockOfOutput(output.cols);
+	for (int x = 0; x < output.cols; x++) {
+		blockOfOutput[x] = (int)((int64)x * grid.width / output.cols);
+	}
+
+	// one pass per block row, which reads only its own source rows and writes only its own output rows,
+	// so rows can be processed in parallel and an output of the same size can be the source itself
+	parallel_for_(Range(0, grid.height), [&](const Range& range) {
+		std::vector<uint32_t> sums((size_t)image.cols * 3);
+		std::vector<Vec3b> blocks(grid.width);
+		std::vector<Vec3b> expanded(output.cols);
+
+		for (int block = range.start; block < range.end; block++) {
+			Range rows = blockSpan(block, grid.height, image.rows);
+
+			// summing the block row's pixels down each column, vectorized
+			std::fill(sums.begin(), sums.end(), 0);
+			for (int y = rows.start; y < rows.end; y++) {
+				accumulateRow(image.ptr<uchar>(y), image.cols * 3, sums.data());
+			}
+
+			// then across each block's columns into the rounded block mean
+			for (int column = 0; column < grid.width; column++) {
+				uint64 total[3] = { 0, 0, 0 };
+
+				for (int x = columns[column].start; x < columns[column].end; x++) {
+					total[0] += sums[x * 3];
+					total[1] += sums[x * 3 + 1];
+					total[2] += sums[x * 3 + 2];
+				}
+
+				uint64 count = (uint64)columns[column].size() * rows.size();
+				blocks[column] = Vec3b((uchar)((total[0] + count / 2) / count), (uchar)((total[1] + count / 2) / count), (uchar)((total[2] + count / 2) / count));
+			}
+
+			// expanding one output row and copying it over the block row's other output rows
+			for (int x = 0; x < output.cols; x++) {
+				expanded[x] = blocks[blockOfOutput[x]];
+			}
+
+			int outputTop = (int)(((int64)block * output.rows + grid.height - 1) / grid.height);
+			int outputBottom = (int)(((int64)(block + 1) * output.rows + grid.height - 1) / grid.height);
+
+			for (int y = outputTop; y < outputBottom; y++) {
+				std::memcpy(output.ptr<uchar>(y), expanded.data(), (size_t)output.cols * 3);
+			}
+		}
+		});
+}
+void ImagePipeline::accumulateRow(const uchar* pixels, int bytes, uint32_t* sums)
+{
+	int i = 0;
+
+#if defined(COR_AVX2)
+	// widening 32 bytes at a time into four vectors of eight 32-bit sums
+	for (; i + 32 <= bytes; i += 32) {
+		__m256i bytes32 = _mm256_loadu_si256((const __m256i*)(pixels + i));
+		__m128i low = _mm256_castsi256_si128(bytes32);
+		__m128i high = _mm256_extracti128_si256(bytes32, 1);
+
+		__m256i* sum = (__m256i*)(sums + i);
+		_mm256_storeu_si256(sum, _mm256_add_epi32(_mm256_loadu_si256(sum), _mm256_cvtepu8_epi32(low)));
+		_mm256_storeu_si256(sum + 1, _mm256_add_epi32(_mm256_loadu_si256(sum + 1), _mm256_cvtepu8_epi32(_mm_srli_si128(low, 8))));
+		_mm256_storeu_si256(sum + 2, _mm256_add_epi32(_mm256_loadu_si256(sum + 2), _mm256_cvtepu8_epi32(high)));
+		_mm256_storeu_si256(sum + 3, _mm256_add_epi32(_mm256_loadu_si256(sum + 3), _mm256_cvtepu8_epi32(_mm_srli_si128(high, 8))));
+	}
+#elif defined(COR_SSE41)
+	// widening 16 bytes at a time into four vectors of four 32-bit sums
+	for (; i + 16 <= bytes; i += 16) {
+		__m128i bytes16 = _mm_loadu_si128((const __m128i*)(pixels + i));
+
+		__m128i* sum = (__m128i*)(sums + i);
+		_mm_storeu_si128(sum, _mm_add_epi32(_mm_loadu_si128(sum), _mm_cvtepu8_epi32(bytes16)));
+		_mm_storeu_si128(sum + 1, _mm_add_epi32(_mm_loadu_si128(sum + 1), _mm_cvtepu8_epi32(_mm_srli_si128(bytes16, 4))));
+		_mm_storeu_si128(sum + 2, _mm_add_epi32(_mm_loadu_si128(sum + 2), _mm_cvtepu8_epi32(_mm_srli_si128(bytes16, 8))));
+		_mm_storeu_si128(sum + 3, _mm_add_epi32(_mm_loadu_si128(sum + 3), _mm_cvtepu8_epi32(_mm_srli_si128(bytes16, 12))));
+	}
+#endif
+
+	// scalar sums for the remaining bytes
+	for (; i < bytes; i++) {
+		sums[i] += pixels[i];
+	}
+}
+Mat ImagePipeline::huesImage(Mat image, const Palette& palette)
+{
+	// the source may be shared with the image cache, so recoloring happens on a private copy
+	image = image.clone();
+
+	// iteration over image to check if color of pixel is equal to any colors in the initial color
+	// then, this pixel will be set to the filtered color chosen, pixels without a match left untouched
+	for (int i = 0; i < image.rows; i++) {
+		Vec3b* pixel = image.ptr<Vec3b>(i);
+
+		for (int j = 0; j < image.cols; j++) {
+			pixel[j] = palette.target(pixel[j]);
+		}
+	}
+
+	return image;
+}
+IndexedImage ImagePipeline::huesImage(IndexedImage image, const Palette& palette)
+{
+	// each palette entry matching an initial color takes the filtered color chosen, the indices are untouched
+	return IndexedImage(image.indices, palette.remap(image.palette));
+}
+std::vector<Vec3b> ImagePipeline::gatherColors(Mat image) {
+	// counting every distinct color in parallel, most common first
+	ColorHistogram histogram(8);
+	histogram.build(image);
+	histogram.sortByCount();
+
+	return histogram.colors;
+}
+std::vector<Vec3b> ImagePipeline::gatherColors(IndexedImage image) {
+	// the palette of an indexed image is already known, so only repeated entries are dropped
+	std::vector<Vec3b> colors;
+
+	for (const Vec3b& color : image.palette) {
+		if (std::find(colors.begin(), colors.end(), color) == colors.end()) {
+			colors.push_back(color);
+		}
+	}
+
+	return colors;
+}
+
+
+BatchRunner::BatchRunner()
+{
+	// one file per hardware thread, the kernels inside each file sharing what is left over
+	jobs = std::max(1, QThread::idealThreadCount());
+
+	recipe.kmeans = false;
+	recipe.pixelate = false;
+	recipe.hues = false;
+	recipe.k = 6;
+	recipe.pixFactor = 64;
+	recipe.pixStretch = false;
+	recipe.pixAspect = false;
+	recipe.sampling = pipeline.kMeansSampling;
+	recipe.samples = pipeline.kMeansSamples;
+	recipe.histogramBits = pipeline.kMeansHistogramBits;
+	recipe.seed = pipeline.kMeansSeed;
+	recipe.seeded = pipeline.kMeansSeeded;
+	recipe.algorithm = pipeline.kMeansAlgorithm;
+	recipe.autoK = false;
+	recipe.tileBudget = pipeline.tileBudget;
+
+	// centers are fitted on a proxy of at most this size and then labelled over the full image, like an export
+	recipe.display = Size(1024, 1024);
+	recipe.preview = false;
+}
+int BatchRunner::run(QString inputDirectory, QString outputDirectory)
+{
+	QDir input(inputDirectory);
+	QDir output(outputDirectory);
+
+	if (!input.exists()) {
+		std::cerr << "cor: input directory " << inputDirectory.toStdString() << " does not exist" << std::endl;
+		return -1;
+	}
+
+	if (!output.exists() && !QDir().mkpath(outputDirectory)) {
+		std::cerr << "cor: output directory " << outputDirectory.toStdString() << " could not be created" << std::endl;
+		return -1;
+	}
+
+	QStringList files = input.entryList({ "*.png", "*.jpg", "*.jpeg", "*.bmp", "*.tif", "*.tiff", "*.webp" }, QDir::Files, QDir::Name);
+
+	// files in flight are bounded by the pool, and OpenCV's own threads are split between them to avoid oversubscription
+	int workers = std::max(1, std::min(jobs, (int)files.size()));
+	int kernelThreads = getNumThreads();
+	setNumThreads(std::max(1, kernelThreads / workers));
+
+	QThreadPool pool;
+	pool.setMaxThreadCount(workers);
+
+	std::atomic<int> next(0);
+	std::atomic<int> failed(0);
+	std::atomic<int64> pixels(0);
+	QMutex outputMutex;
+
+	QElapsedTimer timer;
+	timer.start();
+
+	// every worker pulls the next file, so one file's encode overlaps another's decode and compute
+	for (int worker = 0; worker < workers; worker++) {
+		pool.start([&]() {
+			std::shared_ptr<std::atomic_bool> cancelled = std::make_shared<std::atomic_bool>(false);
+
+			for (int index = next++; index < (int)files.size(); index = next++) {
+				PipelineRequest request = recipe;
+				request.imagePath = input.filePath(files[index]).toStdString();
+				request.exportPath = output.filePath(files[index]).toStdString();
 
-		// accepting the event and subsequent action
-		drag_enter_event->acceptProposedAction();
+				PipelineResult result = pipeline.run(request, cancelled);
 
-		// using QT 'emit' mechanism to emit signal denote file has entered drag space
-		emit dragEntered(drag_enter_event->mimeData());
-		break;
-	}
-	case QEvent::DragLeave:
-	{
-		// casting to QDragLeaveEvent for leave event
-		auto drag_leave_event = static_cast<QDragLeaveEvent*>(event);
+				if (!result.completed) {
+					failed++;
 
-		// accepting the action
-		drag_leave_event->accept();
+					QMutexLocker locker(&outputMutex);
+					std::cerr << "cor: " << request.imagePath << " could not be processed" << std::endl;
+					continue;
+				}
 
-		// using QT 'emit' mechanism to emit signal to denote file has departed drag space
-		emit dragDeparted();
-		break;
+				pixels += (int64)result.source.area();
+			}
+			});
 	}
-	case QEvent::Drop:
-	{
-		// casting to QDropEvent for leave event
-		auto drop_event = static_cast<QDropEvent*>(event);
 
-		// acepting the event and subsequent action
-		drop_event->acceptProposedAction();
+	pool.waitForDone();
+	setNumThreads(kernelThreads);
 
-		// using QT 'emit' mechanism to emit signal to denote file has been dropped and data has been collected
-		emit dragDropped(drop_event->mimeData());
-		break;
-	}
-	default:
+	// throughput over the whole run, counting source pixels
+	double seconds = std::max(1e-9, timer.nsecsElapsed() / 1e9);
+	int processed = (int)files.size() - failed.load();
 
-		// returns self for program continuity
-		return QObject::eventFilter(obj, event);
-	}
+	std::cout << "cor: " << processed << " of " << files.size() << " images in " << seconds << " s, "
+		<< processed / seconds << " images/s, " << pixels.load() / 1e6 / seconds << " MP/s" << std::endl;
 
-	// QT 'eventFilter' objects must return boolean objects
-	return true;
+	return failed.load();
 }
 
 
@@ -282,7 +3125,7 @@ void SpinBox::minus(int minimum)
 }
 
 
-ColorDialog::ColorDialog(QWidget* parent)
+ColorDialog::ColorDialog(PaletteModel* model, QWidget* parent)
 	: QDialog(parent) {
 	this->setWindowTitle("color reassignment");
 
@@ -300,46 +3143,67 @@ ColorDialog::ColorDialog(QWidget* parent)
 		"}");
 
 	colorPaletteDialog = new QColorDialog(this);
+	chosenColorIndex = 0;
+
+	// the dialog only observes the palette, redrawing whenever its version moves past the one shown
+	this->model = model;
+	shownVersion = ~(quint64)0;
+	connect(model, &PaletteModel::changed, this, &ColorDialog::updateColors);
+
+	// chosen colors are written back to the model rather than into the row stylesheets
+	connect(colorPaletteDialog, &QColorDialog::colorSelected, this,
+		[this](const QColor& color) {
+			this->model->setTargetColor(chosenColorIndex, Vec3b(color.blue(), color.green(), color.red()));
+		});
 }
 void ColorDialog::updateColors()
 {
-	for (int i = 0; i < colors.size(); i++) {
-		QString r = QString::number(colors[i][0]);
-		QString g = QString::number(colors[i][1]);
-		QString b = QString::number(colors[i][2]);
+	if (model->palette.version == shownVersion) {
+		return;
+	}
 
-		QString rDark = QString::number((int)colors[i][0] * 0.8);
-		QString gDark = QString::number((int)colors[i][1] * 0.8);
-		QString bDark = QString::number((int)colors[i][2] * 0.8);
+	shownVersion = model->palette.version;
 
+	const std::vector<Vec3b>& colors = model->palette.sourceColors;
+	const std::vector<Vec3b>& processedColors = model->palette.targetColors;
+
+	for (int i = 0; i < colors.size(); i++) {
 		if (i >= colorLabelArray.size()) {
 			colorLabelArray.append(new ColorDialogRow(this));
 			colorLabelArray[i]->move(65, 10 + (30 * i));
-			colorLabelArray[i]->precolor->setStyleSheet(QString("background:rgb(%1, %2, %3)").arg(r, g, b));
-			colorLabelArray[i]->postcolor->setStyleSheet(QString("QPushButton {"
-				"background:rgb(%1, %2, %3);"
-				"border: none;"
-				"} QPushButton::hover {"
-				"background:rgb(%4, %5, %6)"
-				"}").arg(r, g, b, rDark, gDark, bDark));
 
 			connect(colorLabelArray[i]->postcolor, &QPushButton::released, this,
 				[this, i]() {
 					colorPaletteDialog->show(); chosenColorIndex = i;
 				});
+		}
 
-			connect(colorPaletteDialog, &QColorDialog::colorSelected, this,
-				[this]() {
-					QString color = QColor(colorPaletteDialog->selectedColor()).name();
+		// palette colors are stored in 'bgr' order
+		QString r = QString::number(colors[i][2]);
+		QString g = QString::number(colors[i][1]);
+		QString b = QString::number(colors[i][0]);
+
+		QString pR = QString::number(processedColors[i][2]);
+		QString pG = QString::number(processedColors[i][1]);
+		QString pB = QString::number(processedColors[i][0]);
+
+		QString rDark = QString::number((int)(processedColors[i][2] * 0.8));
+		QString gDark = QString::number((int)(processedColors[i][1] * 0.8));
+		QString bDark = QString::number((int)(processedColors[i][0] * 0.8));
+
+		colorLabelArray[i]->precolor->setStyleSheet(QString("background:rgb(%1, %2, %3)").arg(r, g, b));
+		colorLabelArray[i]->postcolor->setStyleSheet(QString("QPushButton {"
+			"background:rgb(%1, %2, %3);"
+			"border: none;"
+			"} QPushButton::hover {"
+			"background:rgb(%4, %5, %6)"
+			"}").arg(pR, pG, pB, rDark, gDark, bDark));
+		colorLabelArray[i]->show();
+	}
 
-					colorLabelArray[chosenColorIndex]->postcolor->setStyleSheet(QString("QPushButton {"
-						"background: %1;"
-						"border: none;"
-						"} QPushButton::hover {"
-						"background:rgb(%4, %5, %6)"
-						"}").arg(color));
-				});
-		}
+	// rows beyond the current palette are hidden rather than destroyed
+	for (int i = colors.size(); i < colorLabelArray.size(); i++) {
+		colorLabelArray[i]->hide();
 	}
 
 	this->resize(300, 50 + colors.size() * 30);
@@ -383,6 +3247,293 @@ MainWindow::MainWindow(QWidget* parent)
 }
 
 
+// out of class definition, needed before c++17 since std::min takes the tile size by reference
+constexpr int TileViewer::tileSize;
+
+TileViewer::TileViewer(QWidget* parent) : QWidget(parent)
+{
+	// pixmap budget in megabytes for uploaded tiles, overridable through 'COR_VIEWER_MB'
+	bool budgetSet = false;
+	int budget = qEnvironmentVariableIntValue("COR_VIEWER_MB", &budgetSet);
+	tileBudget = (size_t)(budgetSet && budget > 0 ? budget : 256) * 1024 * 1024;
+	tileUsage = 0;
+
+	scale = 1.0;
+	fitted = true;
+	complete = true;
+	detailRequested = false;
+
+	this->setCursor(Qt::OpenHandCursor);
+}
+std::vector<Mat> TileViewer::pyramid(Mat image)
+{
+	std::vector<Mat> levels;
+
+	if (image.empty()) {
+		return levels;
+	}
+
+	TraceScope trace("pyramid", image.size());
+
+	// built once per image off the gui thread
+	levels.push_back(image);
+	extend(levels);
+
+	return levels;
+}
+std::vector<Mat> TileViewer::pyramid(IndexedImage image)
+{
+	std::vector<Mat> levels;
+
+	if (image.empty()) {
+		return levels;
+	}
+
+	TraceScope trace("pyramid", image.indices.size(), { { "indexed", 1 } });
+
+	// the full resolution level stays an index plane, painted through the palette as a color table
+	Mat indices = image.indices;
+	levels.push_back(indices);
+
+	if (indices.cols <= tileSize && indices.rows <= tileSize) {
+		return levels;
+	}
+
+	// the first halving renders and averages an even number of rows at a time, so the full color image is never held
+	Mat half((indices.rows + 1) / 2, (indices.cols + 1) / 2, CV_8UC3);
+
+	parallel_for_(Range(0, (indices.rows + tileSize - 1) / tileSize), [&](const Range& range) {
+		for (int strip = range.start; strip < range.end; strip++) {
+			int top = strip * tileSize;
+			int bottom = std::min(indices.rows, top + tileSize);
+
+			Mat rendered = IndexedImage(indices.rowRange(top, bottom), image.palette).render();
+			Mat target = half.rowRange(top / 2, (bottom + 1) / 2);
+			cv::resize(rendered, target, target.size(), 0, 0, INTER_AREA);
+		}
+		});
+
+	levels.push_back(half);
+	extend(levels);
+
+	return levels;
+}
+void TileViewer::extend(std::vector<Mat>& levels)
+{
+	// halving with area averaging until a level fits inside a single tile
+	while (levels.back().cols > tileSize || levels.back().rows > tileSize) {
+		Mat previous = levels.back();
+		Mat half;
+		cv::resize(previous, half, Size((previous.cols + 1) / 2, (previous.rows + 1) / 2), 0, 0, INTER_AREA);
+		levels.push_back(half);
+	}
+}
+void TileViewer::setPyramid(std::vector<Mat> levels, std::vector<Vec3b> palette, bool complete)
+{
+	// the same picture at another resolution, a proxy swapped for its full render or back, or the same size
+	// after a settings change, keeps the zoom and position so a region can be inspected while tweaking
+	bool sameShape = false;
+	double ratio = 1.0;
+
+	if (!this->levels.empty() && !levels.empty()) {
+		ratio = (double)levels[0].cols / this->levels[0].cols;
+		sameShape = std::abs(levels[0].rows - this->levels[0].rows * ratio) <= ratio + 1.0;
+	}
+
+	this->levels = levels;
+	this->palette = palette;
+	this->complete = complete;
+	detailRequested = false;
+
+	tiles.clear();
+	tileIndex.clear();
+	tileUsage = 0;
+
+	if (!sameShape || fitted) {
+		fit();
+	}
+	else {
+		center *= ratio;
+		scale = std::max(fitScale(), std::min(scale / ratio, 64.0));
+		clampCenter();
+		requestDetail();
+	}
+
+	update();
+}
+void TileViewer::fit()
+{
+	if (levels.empty()) {
+		return;
+	}
+
+	scale = fitScale();
+	center = QPointF(levels[0].cols / 2.0, levels[0].rows / 2.0);
+	fitted = true;
+
+	update();
+}
+double TileViewer::fitScale() const
+{
+	// the whole image inside the widget, never enlarged past its native size
+	double factor = std::min((double)width() / levels[0].cols, (double)height() / levels[0].rows);
+
+	return std::min(factor, 1.0);
+}
+void TileViewer::clampCenter()
+{
+	// the shown point stays on the image, so it cannot be panned out of view
+	center.setX(std::max(0.0, std::min(center.x(), (double)levels[0].cols)));
+	center.setY(std::max(0.0, std::min(center.y(), (double)levels[0].rows)));
+}
+void TileViewer::requestDetail()
+{
+	// past one widget pixel per proxy pixel the proxy has nothing more to show, so the full resolution
+	// render is asked for once, and replaces the proxy through setPyramid when it arrives
+	if (!complete && !detailRequested && scale > 1.0) {
+		detailRequested = true;
+		emit detailWanted();
+	}
+}
+QPixmap TileViewer::tile(int level, int column, int row)
+{
+	quint64 key = ((quint64)level << 48) | ((quint64)row << 24) | (quint64)column;
+
+	// moving a hit to the front of the list as most recently used
+	auto found = tileIndex.find(key);
+
+	if (found != tileIndex.end()) {
+		tiles.splice(tiles.begin(), tiles, found.value());
+		return tiles.front().pixmap;
+	}
+
+	// uploading the tile from the level without copying it first, the pixmap conversion making the only copy,
+	// an indexed level going through the palette as its color table
+	Mat image = levels[level];
+	Rect area(column * tileSize, row * tileSize, std::min(tileSize, image.cols - column * tileSize), std::min(tileSize, image.rows - row * tileSize));
+	QImage wrapped = image.type() == CV_8UC1 ? ImagePipeline::imageFormat(IndexedImage(image(area), palette)) : ImagePipeline::imageFormat(image(area));
+	QPixmap pixmap = QPixmap::fromImage(wrapped);
+
+	tiles.push_front({ key, pixmap });
+	tileIndex.insert(key, tiles.begin());
+	tileUsage += (size_t)area.area() * 4;
+
+	// dropping least recently used tiles until under budget, always keeping the newest one
+	while (tileUsage > tileBudget && tiles.size() > 1) {
+		const Tile& oldest = tiles.back();
+		tileUsage -= (size_t)oldest.pixmap.width() * oldest.pixmap.height() * 4;
+		tileIndex.remove(oldest.key);
+		tiles.pop_back();
+	}
+
+	return pixmap;
+}
+void TileViewer::paintEvent(QPaintEvent* event)
+{
+	if (levels.empty()) {
+		return;
+	}
+
+	QPainter painter(this);
+
+	// the coarsest level still holding at least one pixel per widget pixel
+	int level = 0;
+	while (level + 1 < (int)levels.size() && scale * ((double)levels[0].cols / levels[level + 1].cols) <= 1.0) {
+		level++;
+	}
+
+	Mat image = levels[level];
+	double ratioX = (double)levels[0].cols / image.cols;
+	double ratioY = (double)levels[0].rows / image.rows;
+
+	// zoomed in, blocks are drawn with hard edges so pixelation can be inspected
+	painter.setRenderHint(QPainter::SmoothPixmapTransform, scale * ratioX < 1.0);
+
+	// visible part of the image in level pixels
+	QRectF shown = event->rect();
+	double left = (center.x() + (shown.left() - width() / 2.0) / scale) / ratioX;
+	double top = (center.y() + (shown.top() - height() / 2.0) / scale) / ratioY;
+	double right = (center.x() + (shown.right() + 1 - width() / 2.0) / scale) / ratioX;
+	double bottom = (center.y() + (shown.bottom() + 1 - height() / 2.0) / scale) / ratioY;
+
+	int firstColumn = std::max(0, (int)std::floor(left / tileSize));
+	int firstRow = std::max(0, (int)std::floor(top / tileSize));
+	int lastColumn = std::min((image.cols - 1) / tileSize, (int)std::floor(right / tileSize));
+	int lastRow = std::min((image.rows - 1) / tileSize, (int)std::floor(bottom / tileSize));
+
+	// painting only the tiles that intersect the widget
+	for (int row = firstRow; row <= lastRow; row++) {
+		for (int column = firstColumn; column <= lastColumn; column++) {
+			QPixmap pixmap = tile(level, column, row);
+
+			double x = width() / 2.0 + (column * tileSize * ratioX - center.x()) * scale;
+			double y = height() / 2.0 + (row * tileSize * ratioY - center.y()) * scale;
+
+			painter.drawPixmap(QRectF(x, y, pixmap.width() * ratioX * scale, pixmap.height() * ratioY * scale), pixmap, QRectF(pixmap.rect()));
+		}
+	}
+}
+void TileViewer::wheelEvent(QWheelEvent* event)
+{
+	if (levels.empty()) {
+		return;
+	}
+
+	// zooming around the cursor, a notch at a time, from the fitted size out to 64 widget pixels per image pixel
+	double factor = std::pow(1.25, event->angleDelta().y() / 120.0);
+	double zoomed = std::max(fitScale(), std::min(scale * factor, 64.0));
+
+	QPointF offset = event->position() - QPointF(width() / 2.0, height() / 2.0);
+	QPointF point = center + offset / scale;
+
+	scale = zoomed;
+	center = point - offset / scale;
+	fitted = false;
+
+	clampCenter();
+	requestDetail();
+	update();
+
+	event->accept();
+}
+void TileViewer::mousePressEvent(QMouseEvent* event)
+{
+	// panning by dragging with the left button
+	if (event->button() == Qt::LeftButton) {
+		dragStart = event->pos();
+		dragCenter = center;
+		this->setCursor(Qt::ClosedHandCursor);
+	}
+}
+void TileViewer::mouseMoveEvent(QMouseEvent* event)
+{
+	if (levels.empty() || !(event->buttons() & Qt::LeftButton)) {
+		return;
+	}
+
+	center = dragCenter - QPointF(event->pos() - dragStart) / scale;
+	fitted = false;
+
+	clampCenter();
+	update();
+}
+void TileViewer::mouseReleaseEvent(QMouseEvent* event)
+{
+	this->setCursor(Qt::OpenHandCursor);
+}
+void TileViewer::mouseDoubleClickEvent(QMouseEvent* event)
+{
+	// double clicking returns to the whole image
+	fit();
+}
+void TileViewer::resizeEvent(QResizeEvent* event)
+{
+	if (fitted) {
+		fit();
+	}
+}
+
+
 MainPage::MainPage(QWidget* parent)
 	: QFrame(parent) {
 	// initializing width and height of screen
@@ -394,9 +3545,28 @@ MainPage::MainPage(QWidget* parent)
 	this->move(0, 0);
 	this->setStyleSheet("background-color: #285A5E");
 
+	// decoded image cache, with the memory budget in megabytes overridable through 'COR_CACHE_MB'
+	imageCache = new ImageCache();
+
+	bool budgetSet = false;
+	int budget = qEnvironmentVariableIntValue("COR_CACHE_MB", &budgetSet);
+
+	if (budgetSet && budget > 0) {
+		imageCache->setBudget((size_t)budget * 1024 * 1024);
+	}
+
+	// processing kernels, reading their k means and export settings from the environment
+	pipeline = new ImagePipeline(imageCache);
+
 	// line edit initialization
 	fileInput = new ClearLineEdit(this);
 
+	// dropped files are queued and decoded in the background before load is pressed
+	connect(fileInput->dragDropFilter,
+		&DragDropFilter::dragDropped,
+		this,
+		&MainPage::queueDropped);
+
 	// accepts drops in screen for drag and drop functionality
 	this->setAcceptDrops(true);
 
@@ -430,8 +3600,13 @@ MainPage::MainPage(QWidget* parent)
 		this,
 		[this]() {updateImagePath(false, false, false, 0, 0, false); });
 
-	// label initialization for frame that picture is contained in
-	pic = new QLabel(pictureFrame);
+	// zoomable viewer filling the frame that picture is contained in, shown once there is a result
+	viewer = new TileViewer(pictureFrame);
+	viewer->resize(pictureFrame->width(), pictureFrame->height());
+	viewer->hide();
+
+	// zooming past the proxy's pixels swaps in a full resolution render
+	connect(viewer, &TileViewer::detailWanted, this, &MainPage::renderDetail);
 
 	// manipulation block
 	bounding = new QLabel(this);
@@ -478,6 +3653,14 @@ MainPage::MainPage(QWidget* parent)
 	pixStretch = new SliderSwitch("Stretch", this);
 	pixStretch->movePos(1000, 50);
 
+	// aspect switch beside it, a grid following the image's aspect ratio so blocks stay square without stretching
+	pixAspect = new SliderSwitch("Aspect", this);
+	pixAspect->movePos(1160, 50);
+
+	// automatic k switch, sweeping every k up to the spin box value and keeping the elbow
+	autoK = new SliderSwitch("Auto K", this);
+	autoK->movePos(1000, 85);
+
 	// entry button creation, geometry, and styling
 	entryButton = new QPushButton("Enter", this);
 	entryButton->resize(100, 30);
@@ -504,6 +3687,56 @@ MainPage::MainPage(QWidget* parent)
 			pixFactor->count,
 			!(pixStretch->switchState)); });
 
+	// export button creation, geometry, and styling, rendering the full resolution image to a file
+	exportButton = new QPushButton("Export", this);
+	exportButton->resize(100, 30);
+	exportButton->move(((screenWidth / 4) * 3) - 50, 200);
+	exportButton->setStyleSheet("QPushButton {"
+		"color: #A3B1C4;"
+		"border: 1px solid #7BA7AB;"
+		"border-style: solid;"
+		"border-radius: 5px;"
+		"font: 8pt Comic Sans MS;"
+		"} QPushButton::Hover {"
+		"background-color: #775B59;"
+		"color: #A8F9FF;"
+		"}");
+
+	// slot connection for full resolution export
+	connect(exportButton, &QPushButton::released, this, &MainPage::exportImage);
+
+	// progress bar creation, geometry, and styling, shown while the pipeline runs in the background
+	progressBar = new QProgressBar(this);
+	progressBar->resize(150, 16);
+	progressBar->move(((screenWidth / 4) * 3) + 60, 172);
+	progressBar->setRange(0, 100);
+	progressBar->setTextVisible(false);
+	progressBar->setStyleSheet("QProgressBar {"
+		"border: 1px solid #7BA7AB;"
+		"border-radius: 5px;"
+		"} QProgressBar::chunk {"
+		"background-color: #e98061;"
+		"border-radius: 5px;"
+		"}");
+	progressBar->hide();
+
+	// job state for the background pipeline
+	cancelFlag = std::make_shared<std::atomic_bool>(false);
+	jobTicket = 0;
+
+	// inertia curve of the last automatic k sweep, shown under the buttons
+	inertiaPlot = new QLabel(this);
+	inertiaPlot->resize(200, 110);
+	inertiaPlot->move(((screenWidth / 4) * 3) - 100, 240);
+	inertiaPlot->setStyleSheet("QLabel {"
+		"background-color: transparent;"
+		"border: 1px solid #7BA7AB;"
+		"border-radius: 5px;"
+		"}");
+	inertiaPlot->hide();
+
+	previewAuto = false;
+
 	// colors and colorDialog initialization, geometry, and styling
 	colors = new QPushButton("Colors", this);
 	colors->move((screenWidth / 2) + 168, 120);
@@ -515,7 +3748,8 @@ MainPage::MainPage(QWidget* parent)
 		"font: 10pt Comic Sans MS;"
 		"}");
 
-	colorDialog = new ColorDialog(this);
+	paletteModel = new PaletteModel(this);
+	colorDialog = new ColorDialog(paletteModel, this);
 
 	// button connection for displaying color dialog
 	connect(colors,
@@ -525,215 +3759,314 @@ MainPage::MainPage(QWidget* parent)
 
 }
 
-Mat MainPage::matFormat(String image_path)
+void MainPage::updateImagePath(bool kmeans, bool pixelate, bool hues, int k, int pixFactor, bool pixStretch)
 {
-	// initialization and output of formatted 'rgb' image matrix from filepath
-	Mat input = imread(image_path);
-	Mat output;
+	TraceScope trace("updateImagePath", Size(), { { "k", k }, { "factor", pixFactor } });
 
-	cvtColor(input, output, COLOR_BGR2RGB);
+	// cancelling any job still running, its result will be discarded
+	cancelFlag->store(true);
+	cancelFlag = std::make_shared<std::atomic_bool>(false);
+	jobTicket += 1;
 
-	return output;
-}
-void MainPage::updateImagePath(bool kmeans, bool pixelate, bool hues, int k, int pixFactor, bool pixStretch)
-{
-	// initializing the pixmap from the file text
-	Mat image = matFormat((fileInput->text()).toStdString());
+	// interactive runs work on a proxy the size of the picture frame
+	PipelineRequest request = pipelineRequest(kmeans, pixelate, hues, k, pixFactor, pixStretch);
+	request.preview = true;
 
-	// switch logic
-	if (kmeans) {
-		// k means algorithm
-		image = kMeansImage(image, k);
-	}
-	if (pixelate) {
-		// pixealtion interpolation
-		image = pixelateImage(image, pixFactor, pixStretch);
-	}
-	if (hues) {
-		image = huesImage(image, colorDialog);
-	}
+	// the loaded file leaves the drop queue, and the one after it is decoded while this one is edited
+	dropQueue.removeAll(QString::fromStdString(request.imagePath));
+	prefetchNext();
 
-	// initialization of pixmap from image
-	QPixmap picPixmap = pixmapFormat(image);
+	// progress display
+	progressBar->setValue(0);
+	progressBar->show();
+	progressBar->raise();
 
-	// setting the pixmap and parent of the 'pic' label
-	pic->setPixmap(picPixmap.scaled(pictureFrame->width(), pictureFrame->height(), Qt::KeepAspectRatio));
+	// running the pipeline on the global thread pool
+	quint64 ticket = jobTicket;
+	std::shared_ptr<std::atomic_bool> cancelled = cancelFlag;
 
-	pic->setAlignment(Qt::AlignCenter);
-	pic->setParent(pictureFrame);
-	pic->resize(pictureFrame->width(), pictureFrame->height());
+	QThreadPool::globalInstance()->start([this, request, ticket, cancelled]() {
+		PipelineResult result = pipeline->run(request, cancelled, [this, ticket](int value) {
+			reportProgress(ticket, value);
+			});
 
-	// image output
-	pic->show();
-	pic->activateWindow();
-	pic->raise();
+		// building the viewer's pyramid here too, so the gui thread only uploads the visible tiles
+		std::vector<Mat> levels;
+		bool complete = true;
+
+		if (result.completed && !cancelled->load()) {
+			levels = result.indexed.empty() ? TileViewer::pyramid(result.image) : TileViewer::pyramid(result.indexed);
+
+			// a proxy smaller than the file leaves detail for a full resolution render, the header read being cheap
+			QSize full = QImageReader(QString::fromStdString(request.imagePath)).size();
+			complete = !full.isValid() || (double)full.width() * full.height() <= result.source.area();
+		}
+
+		// posting the finished image back to the gui thread
+		QMetaObject::invokeMethod(this, [this, result, levels, complete, ticket, cancelled]() {
+			finishPipeline(result, levels, complete, ticket, cancelled);
+			}, Qt::QueuedConnection);
+		});
 }
-Mat MainPage::kMeansImage(Mat image, int k)
+void MainPage::exportImage()
 {
-	// matrix initialization for image data
-	Mat data;
+	QString exportPath = QFileDialog::getSaveFileName(this, "export image", QString(), "Images (*.png *.jpg *.bmp *.tif)");
 
-	// matrix conversion and reshaping
-	image.convertTo(data, CV_32F);
-	data = data.reshape(1, data.total());
-
-	// kmeans algorithm execution
-	Mat labels, centers;
-	TermCriteria criteria = TermCriteria(TermCriteria::EPS + TermCriteria::MAX_ITER, 10, 1.0);
-	kmeans(data, k, labels, criteria, 3,
-		KMEANS_PP_CENTERS, centers);
+	if (exportPath.isEmpty()) {
+		return;
+	}
 
-	// reshaping to tensors with size 3 for color channels
-	centers = centers.reshape(3, centers.rows);
-	data = data.reshape(3, data.rows);
+	// full resolution render with the current switches, independent of the preview jobs
+	PipelineRequest request = pipelineRequest(!(kMeans->switchState),
+		!(pixelation->switchState),
+		!(hues->switchState),
+		kValue->count,
+		pixFactor->count,
+		!(pixStretch->switchState));
+	request.preview = false;
+	request.exportPath = exportPath.toStdString();
+	reuseCenters(request);
+
+	std::shared_ptr<std::atomic_bool> cancelled = std::make_shared<std::atomic_bool>(false);
+
+	QThreadPool::globalInstance()->start([this, request, cancelled]() {
+		PipelineResult result = pipeline->run(request, cancelled);
+
+		QMetaObject::invokeMethod(this, [this, result]() {
+			if (!result.completed) {
+				QMessageBox::warning(this, "export", "the image could not be rendered or written");
+				return;
+			}
 
-	// replace pixel value with center value
-	Vec3f* p = data.ptr<Vec3f>();
-	for (size_t i = 0; i < data.rows; i++) {
-		int center_id = labels.at<int>(i);
-		p[i] = centers.at<Vec3f>(center_id);
+			// moving on to the next dropped file, already decoded by the prefetch
+			if (!dropQueue.isEmpty()) {
+				fileInput->setText(dropQueue.takeFirst());
+				prefetchNext();
+			}
+			}, Qt::QueuedConnection);
+		});
+}
+void MainPage::renderDetail()
+{
+	if (shownPath.empty()) {
+		return;
 	}
 
-	// reshaping to 2d matirx for image output
-	image = data.reshape(3, image.rows);
-	image.convertTo(image, CV_8U);
+	// full resolution render of the shown file with the current switches, replacing the proxy in the viewer,
+	// and belonging to the current job so that a newer preview cancels it
+	PipelineRequest request = pipelineRequest(!(kMeans->switchState),
+		!(pixelation->switchState),
+		!(hues->switchState),
+		kValue->count,
+		pixFactor->count,
+		!(pixStretch->switchState));
+	request.imagePath = shownPath;
+	request.preview = false;
+	reuseCenters(request);
+
+	progressBar->setValue(0);
+	progressBar->show();
+	progressBar->raise();
+
+	quint64 ticket = jobTicket;
+	std::shared_ptr<std::atomic_bool> cancelled = cancelFlag;
+
+	QThreadPool::globalInstance()->start([this, request, ticket, cancelled]() {
+		PipelineResult result = pipeline->run(request, cancelled, [this, ticket](int value) {
+			reportProgress(ticket, value);
+			});
+
+		std::vector<Mat> levels;
+		if (result.completed && !cancelled->load()) {
+			levels = result.indexed.empty() ? TileViewer::pyramid(result.image) : TileViewer::pyramid(result.indexed);
+		}
+
+		QMetaObject::invokeMethod(this, [this, result, levels, ticket, cancelled]() {
+			if (ticket != jobTicket || cancelled->load()) {
+				return;
+			}
 
-	// gathers the colors of the clusters produced by the kmeans algorithm
-	gatherColors(image);
-	//colors->addWidgets();
+			progressBar->hide();
 
-	// return of processed image
-	return image;
+			if (!levels.empty()) {
+				TraceScope trace("viewer detail", levels[0].size(), { { "levels", (double)levels.size() }, { "indexed", !result.indexed.empty() } });
+				viewer->setPyramid(levels, result.indexed.palette, true);
+			}
+			}, Qt::QueuedConnection);
+		});
 }
-Mat MainPage::pixelateImage(Mat image, int factor, bool stretch)
+void MainPage::reuseCenters(PipelineRequest& request)
 {
-	// initializing intermediate and output matrices 
-	Mat intermediate;
-	Mat output;
+	// reusing the centers fitted on the proxy when they were fitted for this file and k, or by a sweep up to this k
+	bool fittedForK = request.autoK ? previewAuto && (int)previewCenters.size() <= request.k : !previewAuto && (int)previewCenters.size() == request.k;
 
-	// resizing image to size determined by factor, using OpenCV flag INTER_AREA to save image details
-	cv::resize(image, intermediate, Size(factor, factor), 0, 0, INTER_AREA);
-
-	// logic whether or not to stretch output image to original aspect ratio or square
-	if (stretch) {
-		cv::resize(intermediate, output, Size(image.cols, image.cols), 0, 0, INTER_NEAREST);
+	if (previewPath == request.imagePath && !previewCenters.empty() && fittedForK) {
+		request.centers = previewCenters;
 	}
-	else {
-		cv::resize(intermediate, output, Size(image.cols, image.rows), 0, 0, INTER_NEAREST);
+}
+PipelineRequest MainPage::pipelineRequest(bool kmeans, bool pixelate, bool hues, int k, int pixFactor, bool pixStretch)
+{
+	// capturing every widget value on the gui thread before handing off to the worker
+	PipelineRequest request;
+	request.imagePath = (fileInput->text()).toStdString();
+	request.kmeans = kmeans;
+	request.pixelate = pixelate;
+	request.hues = hues;
+	request.k = k;
+	request.pixFactor = pixFactor;
+	request.pixStretch = pixStretch;
+	request.pixAspect = pixelate && !(pixAspect->switchState);
+	request.sampling = pipeline->kMeansSampling;
+	request.samples = pipeline->kMeansSamples;
+	request.histogramBits = pipeline->kMeansHistogramBits;
+	request.seed = pipeline->kMeansSeed;
+	request.seeded = pipeline->kMeansSeeded;
+	request.algorithm = pipeline->kMeansAlgorithm;
+
+	// with automatic k, the spin box sets the largest k the sweep tries
+	request.autoK = kmeans && !(autoK->switchState);
+	request.tileBudget = pipeline->tileBudget;
+	request.display = Size(pictureFrame->width(), pictureFrame->height());
+
+	if (hues) {
+		request.palette = paletteModel->palette;
 	}
 
-	return output;
+	return request;
 }
-Mat MainPage::huesImage(Mat image, ColorDialog* dialog)
+void MainPage::queueDropped(const QMimeData* mimeData)
 {
-	// initializing arrays for colorLabelObjects and the initial and filtered colors within them
-	QVector<ColorDialogRow*> arr = dialog->colorLabelArray;
-	std::vector<Vec3b> colors = dialog->colors;
-	std::vector<Vec3b> processedColors = dialog->processedColors;
-
-	// iteration over
-	int size = arr.size();
+	QList<QUrl> urls = mimeData->urls();
 
-	for (int i = 0; i < size; i++) {
-		// setting the (r, g, b) values from the initial colors contained in the colorDialog, given by the kmeans algorithm
-		int red = qRed(arr[i]->precolor->palette().color(QWidget::backgroundRole()).toRgb().rgb());
-		int green = qGreen(arr[i]->precolor->palette().color(QWidget::backgroundRole()).toRgb().rgb());
-		int blue = qBlue(arr[i]->precolor->palette().color(QWidget::backgroundRole()).toRgb().rgb());
+	if (urls.isEmpty()) {
+		return;
+	}
 
-		// assignment to c
-		Vec3b c;
-		c[0] = red;
-		c[1] = green;
-		c[2] = blue;
-		colors.push_back(c);
+	// the first file goes into the path field and is decoded right away, the rest wait in drop order
+	for (int i = 1; i < urls.size(); i++) {
+		QString path = fileInput->formatImagePath(urls[i].toString());
 
-		// setting the (r, g, b) values from the processed colors contained in the colorDialog, given by the kmeans algorithm
-		int pRed = qRed(arr[i]->postcolor->palette().color(QWidget::backgroundRole()).toRgb().rgb());
-		int pGreen = qGreen(arr[i]->postcolor->palette().color(QWidget::backgroundRole()).toRgb().rgb());
-		int pBlue = qBlue(arr[i]->postcolor->palette().color(QWidget::backgroundRole()).toRgb().rgb());
+		if (!dropQueue.contains(path)) {
+			dropQueue.append(path);
+		}
+	}
 
-		// assignment to pC
-		Vec3b pC;
-		pC[0] = pRed;
-		pC[1] = pGreen;
-		pC[2] = pBlue;
-		processedColors.push_back(pC);
+	QString current = fileInput->formatImagePath(urls[0].toString());
+	dropQueue.removeAll(current);
 
+	imageCache->prefetch(current.toStdString(), Size(pictureFrame->width(), pictureFrame->height()));
+}
+void MainPage::prefetchNext()
+{
+	if (dropQueue.isEmpty()) {
+		return;
 	}
 
-	// iteration over image to check if color of pixel is equal to any colors in the initial color
-	// then, this pixel will be set to the filtered color chosen
-	for (int i = 0; i < image.rows; i++) {
-		for (int j = 0; j < image.cols; j++) {
-			Vec3b key = image.at<Vec3b>(i, j);
+	imageCache->prefetch(dropQueue.first().toStdString(), Size(pictureFrame->width(), pictureFrame->height()));
+}
+void MainPage::drawInertia(const std::vector<double>& inertia, int chosen)
+{
+	QPixmap plot(inertiaPlot->size());
+	plot.fill(Qt::transparent);
 
-			std::vector<Vec3b>::iterator iterator = std::find(colors.begin(), colors.end(), key);
+	QPainter painter(&plot);
+	painter.setRenderHint(QPainter::Antialiasing);
 
-			int index;
+	// plot area inside a margin, k along the bottom and inertia relative to k = 1 up the side
+	QRectF area(10, 22, plot.width() - 20, plot.height() - 32);
+	double top = std::max(inertia.front(), 1e-9);
+	int count = (int)inertia.size();
 
-			if (iterator != colors.end()) {
-				index = std::distance(colors.begin(), iterator);
+	auto point = [&](int i) {
+		double x = count > 1 ? area.left() + area.width() * i / (count - 1) : area.center().x();
+		double y = area.bottom() - area.height() * (inertia[i] / top);
+		return QPointF(x, y);
+	};
 
-			}
+	painter.setPen(QPen(QColor("#7BA7AB"), 1));
+	painter.drawLine(area.bottomLeft(), area.bottomRight());
+
+	painter.setPen(QPen(QColor("#A3B1C4"), 2));
+	for (int i = 1; i < count; i++) {
+		painter.drawLine(point(i - 1), point(i));
+	}
+
+	// the chosen k marked on the curve
+	painter.setPen(Qt::NoPen);
+	for (int i = 0; i < count; i++) {
+		painter.setBrush(i + 1 == chosen ? QColor("#e98061") : QColor("#A3B1C4"));
+		painter.drawEllipse(point(i), i + 1 == chosen ? 4.0 : 2.5, i + 1 == chosen ? 4.0 : 2.5);
+	}
+
+	painter.setPen(QColor("#e98061"));
+	painter.setFont(QFont("Comic Sans MS", 8));
+	painter.drawText(QRectF(0, 2, plot.width(), 18), Qt::AlignCenter, QString("inertia, k = %1").arg(chosen));
 
-			image.at<Vec3b>(i, j) = processedColors[index];
+	painter.end();
 
+	inertiaPlot->setPixmap(plot);
+	inertiaPlot->show();
+	inertiaPlot->raise();
+}
+void MainPage::reportProgress(quint64 ticket, int value)
+{
+	// progress updates are posted to the gui thread and dropped once a newer job has started
+	QMetaObject::invokeMethod(this, [this, ticket, value]() {
+		if (ticket == jobTicket) {
+			progressBar->setValue(value);
 		}
+		}, Qt::QueuedConnection);
+}
+void MainPage::finishPipeline(PipelineResult result, std::vector<Mat> levels, bool complete, quint64 ticket, std::shared_ptr<std::atomic_bool> cancelled)
+{
+	// results of superseded or cancelled jobs are discarded
+	if (ticket != jobTicket || cancelled->load()) {
+		return;
 	}
 
-	// iteration over colors to set initial colors to filtered colors after execution of algorithm
-	for (int i = 0; i < processedColors.size(); i++) {
-		int r = qRed(arr[i]->postcolor->palette().color(QWidget::backgroundRole()).toRgb().rgb());
-		int g = qGreen(arr[i]->postcolor->palette().color(QWidget::backgroundRole()).toRgb().rgb());
-		int b = qBlue(arr[i]->postcolor->palette().color(QWidget::backgroundRole()).toRgb().rgb());
+	progressBar->hide();
 
-		Vec3b preColor;
-		preColor[0] = r;
-		preColor[1] = g;
-		preColor[2] = b;
+	if (!result.completed) {
+		return;
+	}
 
-		QColor color(arr[i]->postcolor->palette().color(QWidget::backgroundRole()));
+	// updating the color arrays with the clusters found by the worker
+	if (result.clustered) {
+		availableColors = result.colors;
+		paletteModel->setSourceColors(availableColors);
 
-		QString style = QString("background-color: rgb(%1, %2, %3);").arg(QString::number(color.red()),
-			QString::number(color.green()),
-			QString::number(color.blue()));
+		// centers fitted on the proxy, reused by a later export of the same file, taken from the job rather
+		// than the path field, which a drop or a finished export may have changed while the job ran
+		previewPath = result.imagePath;
+		previewCenters = result.centers;
+		previewAuto = !result.inertia.empty();
 
-		arr[i]->precolor->setStyleSheet(style);
+		// the inertia curve of an automatic k sweep, hidden otherwise
+		if (previewAuto) {
+			drawInertia(result.inertia, (int)result.centers.size());
+		}
+		else {
+			inertiaPlot->hide();
+		}
 	}
 
-	return image;
-}
-void MainPage::gatherColors(Mat image) {
-	// deinitializes the available color list
-	availableColors.clear();
+	// handing the pyramid to the viewer, which uploads only the tiles it paints
+	{
+		TraceScope trace("viewer", levels.empty() ? Size() : levels[0].size(), { { "levels", (double)levels.size() }, { "indexed", !result.indexed.empty() } });
 
-	// iterates over whole image to compartmentalize every color
-	for (int i = 0; i < image.rows; i++) {
-		for (int j = 0; j < image.cols; j++) {
-			if (availableColors.size() == 0) {
-				availableColors.push_back(image.at<Vec3b>(i, j));
-			}
-			else {
-				for (int k = 0; k < availableColors.size(); k++) {
-					if (std::find(availableColors.begin(), availableColors.end(), image.at<Vec3b>(i, j)) != availableColors.end()) {
-						break;
-					}
-					else {
-						availableColors.push_back(image.at<Vec3b>(i, j));
-					}
-				}
-			}
+		// another file starts out whole, the same one keeps the zoom and asks for detail again if zoomed in
+		if (result.imagePath != shownPath) {
+			viewer->fitted = true;
 		}
+
+		shownPath = result.imagePath;
+		viewer->setPyramid(levels, result.indexed.palette, complete);
 	}
 
-	// updating the color arrays
-	colorDialog->colors = availableColors;
-	colorDialog->updateColors();
-}
-QPixmap MainPage::pixmapFormat(Mat image) {
-	// outputs a pixmap from a Mat image
-	QPixmap pixmap = QPixmap::fromImage(QImage((unsigned char*)image.data, image.cols, image.rows, QImage::Format_RGB888));
-	return pixmap;
+	// image output
+	viewer->show();
+	viewer->activateWindow();
+	viewer->raise();
 }
 
 MenuPage::MenuPage(QWidget* parent)
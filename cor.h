@@ -22,6 +22,22 @@
 #include <QList>
 #include <QDialog>
 #include <QColorDialog>
+#include <QString>
+#include <QImage>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThreadPool>
+#include <QSet>
+#include <QHash>
+#include <QPointF>
+#include <QProgressBar>
+#include <list>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <string>
+#include <initializer_list>
 
 #include <opencv2/opencv.hpp>
 
@@ -41,6 +57,505 @@ signals:
 
 };
 
+// opt-in chrome trace of the pipeline stages, enabled by setting 'COR_TRACE' to the file it is written to on exit
+class Trace {
+public:
+	// one complete event, with its arguments already formatted as json members
+	struct Event {
+		const char* name;
+		std::string arguments;
+		double start;
+		double duration;
+		int thread;
+	};
+
+	// read once, so a disabled trace costs a single check per scope
+	static bool enabled();
+
+	static double now();
+	static int thread();
+	static void record(Event event);
+	static void write();
+
+	// image buffers allocated by the calling thread, counted only while tracing
+	static thread_local int64 allocations;
+	static thread_local int64 allocatedBytes;
+
+private:
+	static bool start();
+};
+
+// records the wall time of the enclosing scope as one trace event, along with image size and parameters
+class TraceScope {
+public:
+	TraceScope(const char* name, Size size = Size(), std::initializer_list<std::pair<const char*, double>> parameters = {});
+	~TraceScope();
+
+	// sets the image size once it is known, such as after a decode
+	void annotate(Size size);
+
+private:
+	bool active;
+	const char* name;
+	Size size;
+	std::string arguments;
+	double start;
+	int64 allocations;
+	int64 allocatedBytes;
+};
+
+// Mat allocator installed while tracing, counting allocations per thread before handing off to OpenCV's own
+class TraceAllocator : public MatAllocator {
+public:
+	UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, AccessFlag flags, UMatUsageFlags usageFlags) const override;
+	bool allocate(UMatData* data, AccessFlag flags, UMatUsageFlags usageFlags) const override;
+	void deallocate(UMatData* data) const override;
+};
+
+class ImageCache {
+public:
+	explicit ImageCache(size_t budget = 1024 * 1024 * 1024);
+
+	// decoded 'bgr' source and downscaled variants, keyed by path, modification time and size
+	struct Entry {
+		QString path;
+		qint64 modified;
+		qint64 size;
+
+		Mat image;
+		std::vector<std::pair<Size, Mat>> variants;
+
+		// 1 for a full decode, or the 2, 4 or 8 the image was reduced by while decoding for a proxy
+		int reduction;
+
+		size_t bytes;
+	};
+
+	// least recently used entries are kept at the back of the list
+	std::list<Entry> entries;
+
+	size_t budget;
+	size_t usage;
+
+	Mat source(String imagePath);
+	Mat scaled(String imagePath, int width, int height);
+
+	// starts decoding a file and its variant for the given bounds in the background, returning at once
+	void prefetch(String imagePath, Size bounds);
+
+	void setBudget(size_t bytes);
+	void clear();
+
+private:
+	// guards the entries, as lookups come from the gui thread and pipeline workers alike
+	QMutex mutex;
+
+	// paths being decoded outside the lock, with the condition signalled whenever one finishes
+	QSet<QString> pending;
+	QWaitCondition decoded;
+
+	// paths queued or running on the prefetch thread
+	QSet<QString> prefetching;
+	QThreadPool prefetchPool;
+
+	// largest reduction a jpeg can be decoded at while still covering the bounds, read from the header only
+	static int reduction(String imagePath, Size bounds);
+	static Mat decode(String imagePath, int reduction);
+
+	std::list<Entry>::iterator lookup(String imagePath, int reduction);
+	void evict();
+};
+
+class ColorHistogram {
+public:
+	explicit ColorHistogram(int bits = 8);
+
+	// bits kept per channel, 8 for exact colors or fewer to merge nearby colors into one bin
+	int bits;
+
+	// distinct (reduced) colors and the number of pixels holding each, in key order after a build
+	std::vector<Vec3b> colors;
+	std::vector<int64> counts;
+
+	// counts every pixel of an 8-bit 3 channel image, in parallel stripes merged at the end
+	void build(Mat image);
+	void sortByCount();
+
+	// packed key of a pixel, also the index into dense per-key lookup tables
+	uint32_t key(const uchar* pixel) const;
+	size_t keySpace() const;
+
+	// representative color of a packed key
+	Vec3b color(uint32_t key) const;
+
+	// open addressing table of packed keys, used for the per-stripe partial counts
+	struct Table {
+		std::vector<uint32_t> keys;
+		std::vector<int64> counts;
+		size_t used;
+
+		Table();
+		void add(uint32_t key, int64 count);
+		void grow();
+	};
+};
+
+class IndexedImage {
+public:
+	IndexedImage();
+	IndexedImage(Mat indices, std::vector<Vec3b> palette);
+
+	// 8-bit index plane and the colors it indexes, the retained output of k means
+	Mat indices;
+	std::vector<Vec3b> palette;
+
+	bool empty() const;
+
+	// expands the indices into an 8-bit 3 channel image, through this or a replacement palette
+	Mat render() const;
+	Mat render(const std::vector<Vec3b>& colors) const;
+
+	// palette lookup for one row, with a byte shuffle path for palettes of up to 16 colors
+	static void renderRow(const uchar* indices, int width, const Vec3b* colors, int size, uchar* pixels);
+};
+
+class KMeansEngine {
+public:
+	explicit KMeansEngine(int iterations = 10, double epsilon = 1.0, int attempts = 3);
+
+	// largest number of clusters, as labels are stored in 8 bits and accumulated in registers
+	static constexpr int maxCenters = 32;
+
+	// termination criteria and restarts, matching the original OpenCV kmeans call
+	int iterations;
+	double epsilon;
+	int attempts;
+
+	// how centers are fitted, on every pixel or on a sample with only the final labelling over the full image
+	enum Sampling {
+		Full,
+		Random,
+		Stratified,
+		MiniBatch,
+		Histogram
+	};
+
+	// pixels fitted per attempt when sampling, trading quality for time that stays flat with image size
+	Sampling sampling;
+	int sampleSize;
+
+	// bits per channel of the color histogram clustered in histogram mode, 8 being exact
+	int histogramBits;
+
+	// centers and cluster sizes of an earlier pass on the same image, seeding a single short attempt
+	// with the closest pairs merged when k went down, or k means++ picks added when it went up
+	std::vector<Vec3f> warmCenters;
+	std::vector<int64> warmCounts;
+
+	// pixels in each cluster of the last result
+	std::vector<int64> counts;
+
+	// rows per tile when fitting on full images, keeping only center statistics between tiles
+	int tileRows;
+
+	// seed of every attempt's generator, the same seed, image and settings always giving the same centers
+	uint64 randomSeed;
+
+	// lloyd passes measure every pixel against every center, hamerly's keep a lower bound per pixel on the
+	// distance to its second closest center and skip the scan when the bound proves the label cannot change,
+	// giving the same labels and compactness
+	enum Algorithm {
+		Lloyd,
+		Hamerly
+	};
+
+	Algorithm algorithm;
+
+	// clusters the pixels of an 8-bit 3 channel image, returning the compactness of the best attempt
+	double cluster(Mat image, int k, Mat& labels, std::vector<Vec3f>& centers);
+
+	// fits every k from 1 up to the largest on one shared sample, each k warm started from the one before,
+	// keeping the elbow of the inertia curve and returning its compactness over the full image
+	double sweep(Mat image, int maxK, Mat& labels, std::vector<Vec3f>& centers, std::vector<double>& inertia);
+
+	// k at the elbow of an inertia curve starting at k = 1, the point furthest below the chord through its ends
+	static int elbow(const std::vector<double>& inertia);
+
+	// labels the pixels against centers fitted elsewhere, such as on a downscaled proxy
+	double label(Mat image, const std::vector<Vec3f>& centers, Mat& labels);
+
+	// rounds the centers into an 8-bit palette
+	static std::vector<Vec3b> palette(const std::vector<Vec3f>& centers);
+
+	// nearest center assignment for a row of packed pixels, accumulating centroid statistics alongside
+	static void assignRow(const uchar* pixels, int width, const int* fixedCenters, int k, uchar* labels, int64* sums, int64& distortion);
+
+	// the same assignment for a row under hamerly's bounds, scanning only the pixels whose bounds do not settle their label
+	static void assignBoundedRow(const uchar* pixels, int width, const int* fixedCenters, int k, const float* halfSeparation, const float* lowerShift,
+		bool first, uchar* labels, float* lower, int64* sums, int64& distortion);
+
+private:
+	// centers of the previous bounded pass in fixed point, and the per pixel lower bounds
+	struct Bounds {
+		std::vector<int> fixedCenters;
+		std::vector<float> lower;
+	};
+
+	RNG attemptRNG(int attempt) const;
+	bool parallelAttempts(int64 points, int runs) const;
+
+	std::vector<Vec3f> seed(Mat image, int k, RNG& rng);
+	std::vector<Vec3f> start(const std::vector<Vec3f>& points, const std::vector<double>& weights, int k, RNG& rng);
+	Mat sample(Mat image, int count, bool stratified, RNG& rng);
+
+	double fit(Mat points, std::vector<Vec3f>& centers, Mat& labels, std::vector<int64>& sums);
+	double step(Mat points, const std::vector<Vec3f>& centers, Mat& labels, std::vector<int64>& sums, Bounds& bounds);
+	double accumulate(Mat image, const std::vector<Vec3f>& centers, std::vector<int64>& sums);
+	double assignBounded(Mat image, const std::vector<Vec3f>& centers, Mat& labels, std::vector<int64>& sums, Bounds& bounds);
+	double clusterHistogram(Mat image, int k, Mat& labels, std::vector<Vec3f>& centers);
+	double fitMiniBatch(Mat image, std::vector<Vec3f>& centers, RNG& rng);
+	int batchSize() const;
+	double fitHistogram(const ColorHistogram& histogram, std::vector<Vec3f>& centers, std::vector<uchar>& labels);
+	std::vector<Vec3f> seedHistogram(const ColorHistogram& histogram, int k, RNG& rng);
+	double assignHistogram(const ColorHistogram& histogram, const std::vector<Vec3f>& centers, std::vector<uchar>& labels, std::vector<double>& sums);
+	double assign(Mat image, const std::vector<Vec3f>& centers, Mat& labels, std::vector<int64>& sums);
+};
+
+// colors found by k means and the colors each is reassigned to, as contiguous arrays
+struct Palette {
+	std::vector<Vec3b> sourceColors;
+	std::vector<Vec3b> targetColors;
+
+	// bumped on every change, so consumers can tell whether a recolor is still current
+	quint64 version = 0;
+
+	// target of a color, colors without a matching source being kept as they are
+	Vec3b target(const Vec3b& color) const;
+	std::vector<Vec3b> remap(const std::vector<Vec3b>& colors) const;
+};
+
+class PaletteModel : public QObject {
+	Q_OBJECT
+
+public:
+	explicit PaletteModel(QObject* parent = nullptr);
+
+	// owned by the processing side, copied into each pipeline run and observed by the color dialog
+	Palette palette;
+
+	void setSourceColors(std::vector<Vec3b> colors);
+	void setTargetColor(int index, Vec3b color);
+
+signals:
+	void changed();
+};
+
+// settings for one run of the processing pipeline, captured on the gui thread
+struct PipelineRequest {
+	String imagePath;
+
+	bool kmeans;
+	bool pixelate;
+	bool hues;
+	int k;
+	int pixFactor;
+	bool pixStretch;
+
+	// pixelation grid following the image's aspect ratio, so blocks stay square without stretching
+	bool pixAspect;
+
+	KMeansEngine::Sampling sampling;
+	int samples;
+	int histogramBits;
+
+	// k means seed, a seed set by the user also turning off warm starts so results never depend on earlier runs
+	uint64 seed;
+	bool seeded;
+
+	KMeansEngine::Algorithm algorithm;
+
+	// automatic k, with k then being the largest one the sweep tries
+	bool autoK;
+
+	Palette palette;
+
+	// previews run on a proxy the size of the display, full renders reuse the proxy centers when given
+	Size display;
+	bool preview;
+	std::vector<Vec3f> centers;
+
+	// full renders with a path are written to file instead of displayed, streamed within a working set budget
+	String exportPath;
+	size_t tileBudget;
+};
+
+// output of one run of the processing pipeline, handed back to the gui thread or the batch runner
+struct PipelineResult {
+	// the output as plain pixels, or as indices and a palette while it still maps onto them, the other left empty
+	Mat image;
+	IndexedImage indexed;
+
+	std::vector<Vec3b> colors;
+	std::vector<Vec3f> centers;
+
+	// inertia per point for every k of an automatic k sweep, empty otherwise
+	std::vector<double> inertia;
+
+	// path the job ran on, and the dimensions of the decoded source for throughput reporting
+	String imagePath;
+	Size source;
+
+	bool completed;
+	bool clustered;
+};
+
+// memoized outputs of the interactive pipeline stages, keyed by a hash of the input's key and the stage's parameters
+class StageCache {
+public:
+	explicit StageCache(size_t capacity = 12);
+
+	enum Stage {
+		KMeans = 1,
+		Pixelate,
+		Hues,
+		Grid
+	};
+
+	// a stage's output, holding the source it was derived from so its buffer address stays unique while cached
+	struct Entry {
+		uint64 key;
+		Mat source;
+		Mat image;
+		IndexedImage indexed;
+		std::vector<Vec3f> centers;
+		std::vector<Vec3b> colors;
+		std::vector<double> inertia;
+	};
+
+	// most recently used entries are kept at the front of the list
+	std::list<Entry> entries;
+	size_t capacity;
+
+	bool find(uint64 key, Entry& entry);
+	void insert(Entry entry);
+	void clear();
+
+	// folds a value or a byte range into a running key
+	static uint64 combine(uint64 seed, uint64 value);
+	static uint64 combine(uint64 seed, const void* data, size_t bytes);
+
+private:
+	// guards the entries, as previews may still be finishing while a newer one starts
+	QMutex mutex;
+};
+
+// the processing kernels and the order they run in, free of any widget so batch runs can share them
+class ImagePipeline {
+public:
+	explicit ImagePipeline(ImageCache* cache = nullptr);
+
+	// sources are decoded through the cache when one is given, and straight from file otherwise
+	ImageCache* cache;
+
+	// k means sampling mode, sample size and histogram precision
+	KMeansEngine::Sampling kMeansSampling;
+	int kMeansSamples;
+	int kMeansHistogramBits;
+
+	// k means passes, 'COR_KMEANS_ALGORITHM' choosing between 'lloyd' and 'hamerly'
+	KMeansEngine::Algorithm kMeansAlgorithm;
+
+	// k means seed, and whether it was set through 'COR_KMEANS_SEED' rather than left at the default
+	uint64 kMeansSeed;
+	bool kMeansSeeded;
+
+	// working set budget of the tiled full resolution export
+	size_t tileBudget;
+
+	// whether k means runs on the pixelation grid when both stages are on
+	bool reorder;
+
+	// memoized stage outputs, so toggling one switch only recomputes the stages after it
+	StageCache stages;
+
+	// centers of the last clustering, kept to warm start the next pass over the same source, along with
+	// how the clustered pixels were derived from it, such as the size of a pixelation grid
+	Mat kMeansSource;
+	uint64 kMeansDerivation;
+	std::vector<Vec3f> kMeansCenters;
+	std::vector<int64> kMeansCounts;
+	QMutex kMeansMutex;
+
+	// runs every enabled stage, reporting a percentage through the optional progress callback
+	PipelineResult run(PipelineRequest request, std::shared_ptr<std::atomic_bool> cancelled, std::function<void(int)> progress = nullptr);
+
+	Mat source(String imagePath);
+	Mat proxy(String imagePath, Size bounds);
+
+	// 'origin' is the image the pixels were derived from when it is not the image itself, so a freshly
+	// derived image, such as a grid of block means, still warm starts from the last pass over the same origin
+	IndexedImage kMeansImage(Mat image, const PipelineRequest& request, std::vector<Vec3f>& centers, std::vector<double>* inertia = nullptr,
+		Mat origin = Mat(), uint64 derivation = 0);
+	Mat pixelateImage(Mat image, int factor, bool stretch, bool aspect = false, bool inPlace = false);
+	IndexedImage gridImage(Mat image, const PipelineRequest& request, std::vector<Vec3f>& centers, std::vector<double>* inertia = nullptr);
+	// exports streamed over strips, pixelated or without k means, unpixelated k means going through 'tiledIndices'
+	Mat tiledImage(Mat source, const PipelineRequest& request, const std::vector<Vec3f>& centers, std::shared_ptr<std::atomic_bool> cancelled);
+
+	// unpixelated k means labelled strip by strip into a full index plane, with the recolored palette
+	IndexedImage tiledIndices(Mat source, const PipelineRequest& request, const std::vector<Vec3f>& centers, std::shared_ptr<std::atomic_bool> cancelled);
+	Mat huesImage(Mat image, const Palette& palette);
+	IndexedImage huesImage(IndexedImage image, const Palette& palette);
+
+	std::vector<Vec3b> gatherColors(Mat image);
+	std::vector<Vec3b> gatherColors(IndexedImage image);
+
+	// blocks across and down for a pixelation factor, square or following the image's aspect ratio
+	static Size pixelGrid(Size image, int factor, bool aspect);
+
+	// source positions of one block along a side, a position belonging to block floor(position * blocks / size)
+	static Range blockSpan(int block, int blocks, int size);
+
+	// block means and their expansion in a single parallel pass, the output may be the source itself when the same size
+	// and the grid has no more blocks than the image has rows and columns
+	static void pixelate(Mat image, Size grid, Mat output);
+
+	// nearest neighbour expansion of a grid of cells to a size, with the same block mapping as pixelation
+	static Mat expandBlocks(Mat grid, Size size);
+
+	// adds a row of bytes into 32-bit running sums
+	static void accumulateRow(const uchar* pixels, int bytes, uint32_t* sums);
+
+	// downscales with INTER_AREA to fit inside the bounds, images that already fit are returned as is
+	static Mat fitted(Mat image, Size bounds);
+
+	// wraps a 'bgr' Mat for display without copying its pixels
+	static QImage imageFormat(Mat image);
+
+	// wraps an indexed image as 8-bit indices and a color table, again without copying
+	static QImage imageFormat(IndexedImage image);
+
+	// writes palette-capable formats as indices and a color table, others after rendering to pixels
+	static bool writeImage(String path, IndexedImage image);
+};
+
+// headless runs of one recipe over a directory, as a bounded pool of workers each decoding, processing and encoding a file
+class BatchRunner {
+public:
+	BatchRunner();
+
+	// shared by every worker, with its settings read from the environment like the interactive pipeline
+	ImagePipeline pipeline;
+
+	// recipe applied to every file, the path fields being filled per file
+	PipelineRequest recipe;
+
+	// files processed at once, each one overlapping its decode, compute and encode with the others
+	int jobs;
+
+	// processes every image in the input directory into the output directory, returning the number that failed
+	int run(QString inputDirectory, QString outputDirectory);
+};
+
 class ClearLineEdit : public QLineEdit {
 	Q_OBJECT
 
@@ -109,13 +624,14 @@ class ColorDialog : public QDialog {
 	Q_OBJECT
 
 public:
-	explicit ColorDialog(QWidget* parent = nullptr);
+	explicit ColorDialog(PaletteModel* model, QWidget* parent = nullptr);
 
 	void updateColors();
 	QVector<ColorDialogRow*> colorLabelArray;
 
-	std::vector<Vec3b> colors;
-	std::vector<Vec3b> processedColors;
+	// palette observed by the dialog, owned by the processing side, and the version of it the rows show
+	PaletteModel* model;
+	quint64 shownVersion;
 
 	QLabel* color;
 
@@ -127,6 +643,74 @@ public:
 
 };
 
+// zoomable view of a processed image, painting only the visible tiles of a pyramid built once per image
+class TileViewer : public QWidget {
+	Q_OBJECT
+
+public:
+	explicit TileViewer(QWidget* parent = nullptr);
+
+	// side of the square tiles every level is cut into
+	static constexpr int tileSize = 256;
+
+	// the full resolution image followed by halved levels, down to one that fits inside a single tile
+	static std::vector<Mat> pyramid(Mat image);
+	static std::vector<Mat> pyramid(IndexedImage image);
+
+	// levels that are complete hold the image at its full resolution, others are a proxy the viewer asks
+	// to have replaced through detailWanted once it is zoomed past the proxy's own pixels
+	void setPyramid(std::vector<Mat> levels, std::vector<Vec3b> palette = {}, bool complete = true);
+	void fit();
+
+	// levels as 'bgr' pixels, except for an indexed image's full resolution level, painted through the palette
+	std::vector<Mat> levels;
+	std::vector<Vec3b> palette;
+
+	// widget pixels per full resolution pixel, the image point shown at the widget's center,
+	// and whether the view still shows the whole image
+	double scale;
+	QPointF center;
+	bool fitted;
+
+	// whether the levels are the full resolution image, and whether a full resolution render was asked for already
+	bool complete;
+	bool detailRequested;
+
+	// pixmaps of the tiles painted so far, least recently used at the back, held within a budget in bytes
+	struct Tile {
+		quint64 key;
+		QPixmap pixmap;
+	};
+
+	std::list<Tile> tiles;
+	QHash<quint64, std::list<Tile>::iterator> tileIndex;
+	size_t tileBudget;
+	size_t tileUsage;
+
+signals:
+	void detailWanted();
+
+protected:
+	void paintEvent(QPaintEvent* event) override;
+	void wheelEvent(QWheelEvent* event) override;
+	void mousePressEvent(QMouseEvent* event) override;
+	void mouseMoveEvent(QMouseEvent* event) override;
+	void mouseReleaseEvent(QMouseEvent* event) override;
+	void mouseDoubleClickEvent(QMouseEvent* event) override;
+	void resizeEvent(QResizeEvent* event) override;
+
+private:
+	QPoint dragStart;
+	QPointF dragCenter;
+
+	static void extend(std::vector<Mat>& levels);
+
+	double fitScale() const;
+	void clampCenter();
+	void requestDetail();
+	QPixmap tile(int level, int column, int row);
+};
+
 class MainPage : public QFrame
 {
 	Q_OBJECT
@@ -142,7 +726,7 @@ public:
 	QPushButton* loadButton;
 
 	QString* filePath;
-	QLabel* pic;
+	TileViewer* viewer;
 
 	QLabel* bounding;
 
@@ -151,6 +735,7 @@ public:
 	SliderSwitch* hues;
 
 	QPushButton* entryButton;
+	QPushButton* exportButton;
 
 	SpinBox* kValue;
 	QLabel* kLabel;
@@ -158,30 +743,58 @@ public:
 	SpinBox* pixFactor;
 	QLabel* pixLabel;
 	SliderSwitch* pixStretch;
+	SliderSwitch* pixAspect;
+	SliderSwitch* autoK;
 
 	QPushButton* colors;
 	ColorDialog* colorDialog;
+	PaletteModel* paletteModel;
 	//DropdownColorDialog* test1;
 
 	std::vector<Vec3b> availableColors;
 
-	QLabel* tester;
+	ImageCache* imageCache;
+	ImagePipeline* pipeline;
 
+	// dropped files waiting their turn after the one in the path field, in drop order
+	QStringList dropQueue;
 
-private slots:
-	void updateImagePath(bool kmeans, bool pixelate, bool hues, int k, int pixFactor, bool pixStretch);
+	// centers fitted by the last preview and the file they were fitted on
+	String previewPath;
+	std::vector<Vec3f> previewCenters;
+	bool previewAuto;
+
+	// file the viewer currently shows, a different one being shown whole rather than at the last zoom
+	String shownPath;
+
+	// inertia curve of the last automatic k sweep
+	QLabel* inertiaPlot;
+
+	QProgressBar* progressBar;
 
-	Mat matFormat(String imagePath);
+	// background job state, a newer job cancels the one before it
+	std::shared_ptr<std::atomic_bool> cancelFlag;
+	quint64 jobTicket;
+
+	QLabel* tester;
 
-	Mat kMeansImage(Mat image, int k);
-	Mat pixelateImage(Mat image, int factor, bool stretch);
-	Mat huesImage(Mat image, ColorDialog* dialog);
 
-	void gatherColors(Mat image);
+private slots:
+	void updateImagePath(bool kmeans, bool pixelate, bool hues, int k, int pixFactor, bool pixStretch);
+	void exportImage();
+	void renderDetail();
+	void queueDropped(const QMimeData* mimeData);
 
 	//void buttonInit(DropDownColors* buttons);
 
-	QPixmap pixmapFormat(Mat image);
+private:
+	// pipeline stages run on the global thread pool, everything touching widgets stays on the gui thread
+	PipelineRequest pipelineRequest(bool kmeans, bool pixelate, bool hues, int k, int pixFactor, bool pixStretch);
+	void reportProgress(quint64 ticket, int value);
+	void prefetchNext();
+	void reuseCenters(PipelineRequest& request);
+	void drawInertia(const std::vector<double>& inertia, int chosen);
+	void finishPipeline(PipelineResult result, std::vector<Mat> levels, bool complete, quint64 ticket, std::shared_ptr<std::atomic_bool> cancelled);
 };
 
 class MenuPage : public QFrame
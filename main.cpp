@@ -1,8 +1,127 @@
 #include "cor.h"
 #include <QApplication>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QColor>
+#include <iostream>
+
+// headless batch mode, e.g. 'cor --kmeans 6 --pixelate 64 --stretch in/ out/'
+int batch(int argc, char* argv[])
+{
+	// a core application only, so no display or widget is ever created
+	QCoreApplication app(argc, argv);
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("runs one k means, pixelation and recolor recipe over every image in a directory");
+	parser.addHelpOption();
+
+	QCommandLineOption kmeansOption("kmeans", "clusters the colors into <k> centers", "k");
+	QCommandLineOption autoKOption("auto-k", "clusters the colors into the k at the elbow of a sweep up to <max>", "max");
+	QCommandLineOption pixelateOption("pixelate", "pixelates into <factor> blocks per side", "factor");
+	QCommandLineOption stretchOption("stretch", "stretches the pixelated output to a square");
+	QCommandLineOption aspectOption("aspect", "fits the pixelation grid to the aspect ratio, keeping blocks square");
+	QCommandLineOption recolorOption("recolor", "replaces a color, as 'rrggbb=rrggbb', may be repeated", "pair");
+	QCommandLineOption seedOption("seed", "seeds k means, identical inputs and settings giving identical palettes", "seed");
+	QCommandLineOption algorithmOption("algorithm", "k means passes, 'lloyd' or the bounded 'hamerly' with the same result", "name");
+	QCommandLineOption jobsOption("jobs", "number of files processed at once", "n");
+	QCommandLineOption proxyOption("proxy", "largest side of the proxy k means centers are fitted on", "pixels");
+
+	parser.addOptions({ kmeansOption, autoKOption, pixelateOption, stretchOption, aspectOption, recolorOption, seedOption, algorithmOption, jobsOption, proxyOption });
+	parser.addPositionalArgument("input", "directory of source images");
+	parser.addPositionalArgument("output", "directory the results are written to, under the same names");
+
+	parser.process(app);
+
+	QStringList directories = parser.positionalArguments();
+
+	if (directories.size() != 2) {
+		parser.showHelp(1);
+	}
+
+	BatchRunner runner;
+
+	if (parser.isSet(kmeansOption)) {
+		runner.recipe.kmeans = true;
+		runner.recipe.k = std::max(1, std::min(parser.value(kmeansOption).toInt(), KMeansEngine::maxCenters));
+	}
+
+	if (parser.isSet(autoKOption)) {
+		runner.recipe.kmeans = true;
+		runner.recipe.autoK = true;
+		runner.recipe.k = std::max(1, std::min(parser.value(autoKOption).toInt(), KMeansEngine::maxCenters));
+	}
+
+	if (parser.isSet(pixelateOption)) {
+		runner.recipe.pixelate = true;
+		runner.recipe.pixFactor = std::max(1, parser.value(pixelateOption).toInt());
+	}
+
+	runner.recipe.pixStretch = parser.isSet(stretchOption);
+	runner.recipe.pixAspect = parser.isSet(aspectOption);
+
+	// recolor pairs, stored in the pipeline's 'bgr' order
+	for (const QString& pair : parser.values(recolorOption)) {
+		QStringList colors = pair.split('=');
+		QColor from("#" + colors.value(0));
+		QColor to("#" + colors.value(1));
+
+		if (colors.size() != 2 || !from.isValid() || !to.isValid()) {
+			std::cerr << "cor: invalid recolor pair " << pair.toStdString() << std::endl;
+			return 1;
+		}
+
+		runner.recipe.hues = true;
+		runner.recipe.palette.sourceColors.push_back(Vec3b(from.blue(), from.green(), from.red()));
+		runner.recipe.palette.targetColors.push_back(Vec3b(to.blue(), to.green(), to.red()));
+	}
+
+	if (parser.isSet(seedOption)) {
+		bool parsed = false;
+		runner.recipe.seed = parser.value(seedOption).toULongLong(&parsed, 0);
+		runner.recipe.seeded = parsed;
+
+		if (!parsed) {
+			std::cerr << "cor: invalid seed " << parser.value(seedOption).toStdString() << std::endl;
+			return 1;
+		}
+	}
+
+	if (parser.isSet(algorithmOption)) {
+		QString algorithm = parser.value(algorithmOption).toLower();
+
+		if (algorithm == "hamerly") {
+			runner.recipe.algorithm = KMeansEngine::Hamerly;
+		}
+		else if (algorithm == "lloyd") {
+			runner.recipe.algorithm = KMeansEngine::Lloyd;
+		}
+		else {
+			std::cerr << "cor: unknown algorithm " << algorithm.toStdString() << std::endl;
+			return 1;
+		}
+	}
+
+	if (parser.isSet(jobsOption)) {
+		runner.jobs = std::max(1, parser.value(jobsOption).toInt());
+	}
+
+	if (parser.isSet(proxyOption)) {
+		int side = std::max(1, parser.value(proxyOption).toInt());
+		runner.recipe.display = Size(side, side);
+	}
+
+	int failed = runner.run(directories[0], directories[1]);
+
+	return failed == 0 ? 0 : 1;
+}
 
 int main(int argc, char* argv[])
 {
+	// any command line arguments select the headless batch mode
+	if (argc > 1) {
+		return batch(argc, argv);
+	}
+
 	// initialization of main application class
 	QApplication app(argc, argv);
 
@@ -12,4 +131,4 @@ int main(int argc, char* argv[])
 
 	// executes the application
 	return app.exec();
-}
\ No newline at end of file
+}